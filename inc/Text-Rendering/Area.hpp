@@ -25,6 +25,8 @@ SSS_TR_BEGIN;
 INTERNAL_BEGIN;
 
 struct Line;
+struct AreaData;
+struct AreaSnapshot;
 class Buffer;
 class BufferInfoVector;
 class AreaPixels;
@@ -43,9 +45,12 @@ enum class PrintMode {
 
 struct TextPart {
     TextPart() = default;
-    TextPart(std::u32string const& s, Format const& f) : str(s), fmt(f) {};
+    TextPart(std::u32string const& s, FormatId f) : str(s), fmt(f) {};
     std::u32string str;
-    Format fmt;
+    // Interned, so read-only : edit a copy, then use setFormat()
+    FormatId fmt;
+    inline Format const& getFormat() const noexcept { return *fmt; };
+    inline void setFormat(Format const& format) { fmt = format; };
 };
 
 class TextParts : public std::vector<TextPart> {
@@ -174,6 +179,30 @@ public:
     /** \overload*/
     void parseString(std::string const& str);
 
+    /** Appends a string at the end of the current text.
+     *  The string may use formats the same way parseStringU32() does,
+     *  starting from the area's format (they don't carry over to further appends).
+     *
+     *  Only the appended text is shaped, laid out and drawn, which
+     *  suits logs, consoles and chats.
+     *
+     *  @param[in] str The UTF32 string to be parsed & appended.
+     *  @sa setMaxLines().
+     */
+    void appendStringU32(std::u32string const& str);
+    /** \overload*/
+    void appendString(std::string const& str);
+    /** Sets the maximum number of lines kept by the area.
+     *  Once exceeded by an eighth, the oldest lines are removed along
+     *  with their text, down to the maximum. Removing lines by batches
+     *  keeps appending cheap. Scrolling stays on the same text.
+     *  @param[in] max_lines The maximum line count, \c 0 for no limit.
+     *  @default \c 0
+     *  @sa appendStringU32().
+     */
+    void setMaxLines(size_t max_lines);
+    inline size_t getMaxLines() const noexcept { return _max_lines; };
+
     void setTextParts(std::vector<TextPart> const& text_parts, bool move_cursor = true);
     std::vector<TextPart> getTextParts() const;
 
@@ -196,6 +225,9 @@ public:
     void clear() noexcept;
 
     static void updateAll();
+    /** Cancels all queued or running draws.
+     *  All areas are then fully redrawn on the next updateAll().
+     */
     static void cancelAll();
 
 private:
@@ -205,6 +237,8 @@ private:
      *  @sa clear(), pixelsGet().
      */
     virtual void _subjectUpdate(Subject const& subject, SSS::Event const& event) override;
+    // Swaps pixel buffers once a draw finished
+    void _pixelsDrawn();
 
 public:
     /** Returns a const pointer to the internal pixels array.
@@ -228,6 +262,42 @@ public:
     void pixelsGetDimensions(int& width, int& height) const noexcept;
 
     void getDimensions(int& width, int& height) const noexcept;
+
+    /** Sets the priority of this area's draws on the render pool.
+     *  Higher priorities are drawn first. The focused area is
+     *  always drawn first.
+     *  @default \c 0
+     *  @sa setRenderThreadCount(), setRenderExecutor().
+     */
+    void setDrawPriority(int priority) noexcept;
+    /** Returns the priority of this area's draws.*/
+    inline int getDrawPriority() const noexcept { return _draw_priority; };
+
+    /** Enables or disables viewport virtualization (disabled by default).
+     *
+     *  When enabled, only the lines intersecting the visible window --
+     *  extended by an overscan margin on both sides -- are rasterized,
+     *  instead of the whole text. Newly exposed lines are rendered
+     *  when scroll() moves the visible window near the overscan edges.
+     * 
+     *  Recommended for tall scrolling areas, such as long logs, as
+     *  memory usage no longer grows with the text's height.
+     *  @sa setOverscan(), scroll().
+     */
+    void setVirtualized(bool virtualized) noexcept;
+    /** Returns whether viewport virtualization is enabled.
+     *  @sa setVirtualized().
+     */
+    inline bool isVirtualized() const noexcept { return _virtualized; };
+    /** Sets the number of rows, in pixels, rasterized above and below
+     *  the visible window when virtualization is enabled (default: 512).
+     *  @sa setVirtualized().
+     */
+    void setOverscan(int pixels) noexcept;
+    /** Returns the overscan margin, in pixels.
+     *  @sa setOverscan().
+     */
+    inline int getOverscan() const noexcept { return _overscan; };
     inline auto getDimensions() const noexcept { return std::make_tuple(_w, _h); };
     inline int getWidth() const noexcept { return _w; };
     inline int getHeight() const noexcept { return _h; };
@@ -322,6 +392,11 @@ private:
     bool _wrapping{ true };
     int _min_w{ 0 };
     int _max_w{ 0 };
+    // Maximum number of lines, 0 for no limit
+    size_t _max_lines{ 0 };
+    // Appended text starts a new buffer past a new line once the last one
+    // holds this many glyphs, so that updates don't copy ever growing buffers
+    static constexpr size_t _max_append_glyphs = 1024;
     // Width of area
     int _w;
     // Height of area
@@ -330,6 +405,13 @@ private:
     int _pixels_h{ 0 };
     // Scrolling index, in pixels
     int _scrolling{ 0 };
+    // Whether only the visible window (+ overscan) is rasterized
+    bool _virtualized{ false };
+    // Rows rasterized above & below the visible window, in pixels
+    int _overscan{ 512 };
+    // Last dispatched rasterized window : first row & height
+    int _window_origin{ 0 };
+    int _window_h{ 0 };
 
     // Default vertical margin, in pixels
     static int _default_margin_v;
@@ -342,6 +424,8 @@ private:
 
     // True -> enables _drawIfNeeded()
     bool _draw{ true };
+    // Priority of draws on the render pool
+    int _draw_priority{ 0 };
     // Print mode, default = instantaneous
     PrintMode _print_mode{ PrintMode::Instant };
     // TypeWriter -> characters per second.
@@ -369,8 +453,9 @@ private:
     Format _format;
     // Buffer vector, one for each differing format
     std::vector<std::unique_ptr<_internal::Buffer>> _buffers;
-    // Buffer informations
-    std::unique_ptr<_internal::BufferInfoVector> _buffer_infos;
+    // Buffer informations, updated from the first modified buffer.
+    // Snapshots share their infos, copied once modified.
+    std::shared_ptr<_internal::BufferInfoVector> _buffer_infos;
     // Total number of glyphs in all ACTIVE buffers
     size_t _glyph_count{ 0 };
 
@@ -392,6 +477,22 @@ private:
 
     // Indexes of line breaks & charsizes
     std::vector<_internal::Line> _lines;
+    // Text, layout & positioned glyphs shared with async draws,
+    // updated in turns as the one of the running draw can't be modified
+    std::array<std::shared_ptr<_internal::AreaSnapshot>, 2> _snapshots;
+    size_t _snapshot_slot{ 0 };  // Last updated snapshot
+    size_t _drawn_slot{ 0 };     // Snapshot of the last draw
+    // Last updated snapshot, reset when _lines or _buffer_infos are updated
+    std::shared_ptr<_internal::AreaSnapshot const> _snapshot;
+
+    // Last dispatched draw state, used to determine damaged regions
+    bool _drawn_cursor{ false };
+    int _drawn_cursor_x{ 0 };
+    int _drawn_cursor_y{ 0 };
+    int _drawn_cursor_h{ 0 };
+    size_t _drawn_selected_first{ 0 };
+    size_t _drawn_selected_last{ 0 };
+    size_t _drawn_last_glyph{ 0 };
 
     /** Unique instance pointer, which are stored in a map.
      *  This is the only way to refer to Area instances.
@@ -401,14 +502,44 @@ private:
 
     static Weak _focused;
 
+    // Frees unused glyph bitmaps once over budget, keeping those of all areas
+    static void _trimGlyphs();
+    // Glyph memory & frame of the last trim which couldn't reach the budget,
+    // delaying further attempts (frame 0 if none)
+    static size_t _trim_failed_memory;
+    static uint64_t _trim_failed_frame;
+
     // Computes _edit_cursor's relative position on the Area
-    void _getCursorPhysicalPos(int& x, int& y) const noexcept;
+    void _getCursorPhysicalPos(int& x, int& y);
     // Ensures _scrolling has a valid value
     void _scrollingChanged() noexcept;
-    // Updates _lines
-    void _updateLines();
-    // Updates _buffer_infos and _glyph_count, then calls _updateLines();
-    void _updateBufferInfos();
+    // Whether the visible window got too close to the rasterized one's edges
+    bool _windowNeedsUpdate() const noexcept;
+    // Updates _lines, marking all pixels as damaged if asked to
+    void _updateLines(bool damage_all = true);
+    // Re-breaks _lines from given modified glyph, until breaks re-synchronize
+    // with the old ones within the last unmodified glyphs.
+    // Returns the height from which lines didn't move, INT_MAX if none.
+    int _reflowLines(size_t first, size_t suffix, size_t old_glyph_count);
+    // Updates a snapshot which no draw uses, along with its glyph display list
+    void _updateSnapshot();
+    // Resets _snapshot, marking lines & runs from given ones as modified
+    void _invalidateSnapshots(size_t first_line, size_t first_run = SIZE_MAX) noexcept;
+    // Updates _buffer_infos and _glyph_count, then re-breaks modified lines.
+    // Glyphs before given one are known to be unmodified.
+    void _updateBufferInfos(size_t from = 0);
+    // Removes the oldest lines (and their text) once _max_lines is exceeded
+    void _evictLines();
+
+    // Marks all pixels as needing a redraw
+    void _damageAll() noexcept;
+    // Marks given pixel region as needing a redraw (x1 & y1 excluded)
+    void _damageRect(int x0, int y0, int x1, int y1) noexcept;
+    // Marks lines holding given glyphs (both included) as needing a redraw
+    void _damageGlyphs(size_t first, size_t last, int padding = 0) noexcept;
+    // Compares given draw data to the last dispatched one and marks
+    // changed regions (cursor, selection, typewriter, animations)
+    void _damageDrawState(_internal::AreaData const& data) noexcept;
 
     // Draws current area if _draw is set to true
     void _drawIfNeeded();
@@ -2,6 +2,7 @@
 #define SSS_TR_FORMAT_HPP
 
 #include "_includes.hpp"
+#include <atomic>
 
 /** @file
  *  Defines SSS::TR::Format and subsequent classes.
@@ -152,9 +153,82 @@ struct SSS_TR_API Format {
     std::u32string tw_long_pauses{ U".!?" };
 };
 
+SSS_TR_API extern Format default_fmt;
+
+/** Compact, reference counted handle to an immutable, interned Format.
+ *  Equal formats share the same handle, so copying, comparing
+ *  and hashing handles is O(1). Interned formats are freed along
+ *  with their last handle.\n
+ *  At most 2^20 distinct formats can be referenced at once,
+ *  interning more throws.
+ *  @sa Format, TextPart.
+ */
+class SSS_TR_API FormatId {
+public:
+    /** Handle to a default constructed Format.*/
+    FormatId();
+    /** Interns given format. Throws if 2^20 distinct formats are referenced.*/
+    FormatId(Format const& fmt);
+    inline FormatId(FormatId const& id) noexcept : _id(id._id) {
+        _entry().refs.fetch_add(1, std::memory_order_relaxed);
+    };
+    inline FormatId& operator=(FormatId const& id) noexcept {
+        id._entry().refs.fetch_add(1, std::memory_order_relaxed);
+        _release();
+        _id = id._id;
+        return *this;
+    };
+    inline ~FormatId() noexcept { _release(); };
+
+    bool operator==(FormatId const& id) const noexcept { return _id == id._id; };
+
+    /** Returns the interned format.*/
+    inline Format const& operator*() const noexcept { return _entry().fmt; };
+    inline Format const* operator->() const noexcept { return &**this; };
+    inline operator Format const&() const noexcept { return **this; };
+    /** Returns the 32-bit index of the interned format.*/
+    inline uint32_t value() const noexcept { return _id; };
+
+private:
+    uint32_t _id;
+
+    // Interned format, and the number of handles to it
+    struct _Entry {
+        Format fmt;
+        std::atomic<uint32_t> refs{ 0 };
+        bool interned{ false }; // Whether the id is in use, guarded by the interning mutex
+    };
+    // Interned formats are stored in fixed-size chunks which never move,
+    // so they can be read without locking while new ones are added
+    static constexpr uint32_t _chunk_bits = 8;
+    static constexpr uint32_t _chunk_mask = (1u << _chunk_bits) - 1;
+    static constexpr uint32_t _chunk_count = 4096;
+    static std::atomic<_Entry*> _chunks[_chunk_count];
+
+    inline _Entry& _entry() const noexcept {
+        return _chunks[_id >> _chunk_bits].load(std::memory_order_acquire)[_id & _chunk_mask];
+    };
+    // Drops this handle's reference, freeing the format if it was the last one
+    inline void _release() noexcept {
+        if (_entry().refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            _free(_id);
+    };
+    // Frees given format unless it was referenced again meanwhile
+    static void _free(uint32_t id) noexcept;
+};
+
 #pragma warning(pop)
 
-SSS_TR_API extern Format default_fmt;
+SSS_TR_END;
+
+template<>
+struct std::hash<SSS::TR::FormatId> {
+    size_t operator()(SSS::TR::FormatId const& id) const noexcept {
+        return std::hash<uint32_t>{}(id.value());
+    }
+};
+
+SSS_TR_BEGIN;
 
 SSS_TR_END;
 
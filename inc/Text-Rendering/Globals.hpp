@@ -2,6 +2,7 @@
 #define SSS_TR_GLOBALS_HPP
 
 #include "_includes.hpp"
+#include <future>
 
 /** @file
  *  Defines global functions and enums.
@@ -50,6 +51,33 @@ SSS_TR_API void addFontDir(std::string const& dir_path);
  *  @sa addFontDir(), unloadFont(), clearFonts().
  */
 SSS_TR_API void loadFont(std::string const& font_filename);
+/** Loads a font in cache on a background thread.
+ *  Draws are run first, as the render pool is used.
+ *  @param[in] font_filename Font file name. Must contain
+ *  extension, eg: \c "arial.ttf".
+ *  @return A future which is ready once the font is loaded, and
+ *  rethrows any loading error.
+ *  @sa loadFont(), prewarmGlyphs().
+ */
+SSS_TR_API std::shared_future<void> loadFontAsync(std::string const& font_filename);
+/** Loads a font and rasterizes given characters on a background thread,
+ *  so that areas using them later don't have to.\n
+ *  Characters are shaped beforehand, so that ligatures and contextual
+ *  forms are rasterized too.
+ *  Glyphs are loaded by small jobs, letting draws run in between.
+ *  Unloading the font meanwhile skips the remaining glyphs.
+ *  @param[in] font_filename Font file name. Must contain
+ *  extension, eg: \c "arial.ttf".
+ *  @param[in] charsizes The charsizes to rasterize the characters at.
+ *  @param[in] chars A character set or sample string, eg: \c U"Hello!".
+ *  @param[in] outline_size The outline size to rasterize outlines
+ *  with, \c 0 for none. Matches Format::outline_size.
+ *  @return A future which is ready once all glyphs are loaded, and
+ *  rethrows any error, including terminate() being called first.
+ *  @sa loadFontAsync(), setGlyphCacheSize().
+ */
+SSS_TR_API std::shared_future<void> prewarmGlyphs(std::string const& font_filename,
+    std::vector<int> const& charsizes, std::u32string const& chars, int outline_size = 0);
 /** Deletes a font that is no longer needed from cache.
  *  @param[in] font_filename Font file name. Must contain
  *  extension, eg: \c "arial.ttf".
@@ -62,6 +90,91 @@ SSS_TR_API void unloadFont(std::string const& font_filename);
  */
 SSS_TR_API void clearFonts() noexcept;
 
+/** Sets the memory budget of the shaping cache, in bytes.
+ *  Shaped runs are shared by all areas, and reused whenever the font,
+ *  charsize, direction, script, language and string all match.\n
+ *  Least recently used runs are evicted first. \c 0 disables the cache.
+ *  @default \c 4 MiB
+ *  @sa getShapingCacheStats(), clearShapingCache().
+ */
+SSS_TR_API void setShapingCacheSize(size_t bytes);
+/** Returns the memory budget of the shaping cache, in bytes.*/
+SSS_TR_API size_t getShapingCacheSize() noexcept;
+/** Returns the estimated memory used by the shaping cache, in bytes.*/
+SSS_TR_API size_t getShapingCacheUsage() noexcept;
+/** Retrieves the shaping cache hit & miss counts since initialization.
+ *  @param[out] hits Will be filled with the number of cache hits.
+ *  @param[out] misses Will be filled with the number of cache misses.
+ */
+SSS_TR_API void getShapingCacheStats(size_t& hits, size_t& misses) noexcept;
+/** Clears the shaping cache.
+ *  Automatically called when fonts are unloaded or the DPI changes.
+ */
+SSS_TR_API void clearShapingCache() noexcept;
+
+/** Sets the memory budget of glyph bitmaps, in bytes, across all
+ *  fonts and charsizes.\n
+ *  Once exceeded, Area::updateAll() frees the least recently used
+ *  glyph atlas pages which hold no glyph of any Area, down to 3/4 of the
+ *  budget. Draws are restarted when this happens.\n
+ *  \c 0 disables the budget.
+ *  @default \c 64 MiB
+ *  @sa getGlyphCacheUsage().
+ */
+SSS_TR_API void setGlyphCacheSize(size_t bytes) noexcept;
+/** Returns the memory budget of glyph bitmaps, in bytes.*/
+SSS_TR_API size_t getGlyphCacheSize() noexcept;
+/** Returns the memory used by glyph bitmaps, in bytes.*/
+SSS_TR_API size_t getGlyphCacheUsage() noexcept;
+
+/** Enables the persistent glyph cache, disabled by default.
+ *  Rasterized glyphs and outlines are written to given directory
+ *  whenever fonts are unloaded (including from terminate()), in files
+ *  keyed by font file hash, charsize and DPI. Fonts loaded afterwards
+ *  memory-map these files, and copy stored glyphs instead of
+ *  rasterizing them.
+ *  @param[in] dir_path The cache directory, created if needed.
+ *  An empty string disables the cache.
+ *  @sa getGlyphDiskCacheDir().
+ */
+SSS_TR_API void setGlyphDiskCacheDir(std::string const& dir_path);
+/** Returns the directory of the persistent glyph cache, empty if disabled.*/
+SSS_TR_API std::string getGlyphDiskCacheDir();
+
+/** Interface to run draw jobs on a host job system, instead of the
+ *  internal render pool.
+ *  @sa setRenderExecutor().
+ */
+class SSS_TR_API RenderExecutor {
+public:
+    virtual ~RenderExecutor() = default;
+    /** Runs given job asynchronously, on any thread.
+     *  Must be thread-safe. Jobs never throw.
+     *  @param[in] job The job to run, once.
+     *  @param[in] priority Jobs with higher priorities should run first.
+     *  The focused Area's jobs have the highest one.
+     */
+    virtual void submit(std::function<void()> job, int priority) = 0;
+};
+
+/** Sets the number of threads of the render pool, shared by all areas.
+ *  Queued draws are kept.
+ *  @param[in] count The number of threads, \c 0 meaning one less
+ *  than the hardware concurrency (minimum 1).
+ *  @default \c 0
+ *  @sa setRenderExecutor(), Area::setDrawPriority().
+ */
+SSS_TR_API void setRenderThreadCount(unsigned int count);
+/** Returns the number of threads of the render pool.*/
+SSS_TR_API unsigned int getRenderThreadCount() noexcept;
+/** Routes all draws to given executor instead of the render pool.
+ *  Already queued draws are handed over to it.\n
+ *  The executor is kept until terminate(), or until replaced.
+ *  @param[in] executor The host executor, \c nullptr to restore
+ *  the internal render pool.
+ */
+SSS_TR_API void setRenderExecutor(std::shared_ptr<RenderExecutor> executor);
+
 /** \cond TODO*/
 SSS_TR_API void setDPI(FT_UInt hdpi, FT_UInt vdpi);
 SSS_TR_API void getDPI(FT_UInt& hdpi, FT_UInt& vdpi) noexcept;
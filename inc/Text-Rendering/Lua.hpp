@@ -86,6 +86,8 @@ inline void lua_setup_TR(sol::state& lua) try
     );
     // Parse & clear
     area["string"] = sol::property(&Area::parseStringU32, &Area::getStringU32);
+    area["append"] = &Area::appendStringU32;
+    area["max_lines"] = sol::property(&Area::getMaxLines, &Area::setMaxLines);
     area["clear_color"] = sol::property(&Area::getClearColor, &Area::setClearColor);
     area["clear"] = &Area::clear;
     // Format
@@ -25,6 +25,7 @@
 #include FT_FREETYPE_H
 #include FT_GLYPH_H
 #include FT_STROKER_H
+#include FT_SIZES_H
 
 // HarfBuzz
 #include <harfbuzz/hb.h>
@@ -3,6 +3,10 @@
 #include "Text-Rendering/Globals.hpp"
 
 #include <cwctype>
+#include <climits>
+#include <charconv>
+#include <list>
+#include <limits>
 
 SSS_TR_BEGIN;
 
@@ -63,6 +67,8 @@ CommandHistory Area::history{};
 int Area::_default_margin_h{ 10 };
 int Area::_default_margin_v{ 10 };
 Area::Weak Area::_focused{};
+size_t Area::_trim_failed_memory{ 0 };
+uint64_t Area::_trim_failed_frame{ 0 };
 
     // --- Constructor, destructor & clear function ---
 
@@ -74,13 +80,12 @@ void Area::_register()
 
 // Constructor, creates a default Buffer
 Area::Area() try
-    : _buffer_infos(std::make_unique<_internal::BufferInfoVector>())
+    : _buffer_infos(std::make_shared<_internal::BufferInfoVector>())
 {
     for (auto& pixels : _pixels) {
         pixels.reset(new _internal::AreaPixels);
         if (!pixels)
             throw_exc("Couldn't allocate internal data");
-        _observe(*pixels);
     }
     _buffers.push_back(std::make_unique<_internal::Buffer>(TextPart(U"", _format)));
     _updateBufferInfos();
@@ -106,7 +111,7 @@ void Area::setWrapping(bool wrapping) noexcept
 {
     if (_wrapping != wrapping) {
         _wrapping = wrapping;
-        _updateBufferInfos();
+        _updateLines();
     }
 }
 
@@ -117,8 +122,10 @@ bool Area::getWrapping() const noexcept
 
 void Area::setWrappingMinWidth(int min_w) noexcept
 {
-    _min_w = min_w;
-    _updateBufferInfos();
+    if (_min_w != min_w) {
+        _min_w = min_w;
+        _updateLines();
+    }
 }
 
 int Area::getWrappingMinWidth() const noexcept
@@ -128,8 +135,10 @@ int Area::getWrappingMinWidth() const noexcept
 
 void Area::setWrappingMaxWidth(int max_w) noexcept
 {
-    _max_w = max_w;
-    _updateBufferInfos();
+    if (_max_w != max_w) {
+        _max_w = max_w;
+        _updateLines();
+    }
 }
 
 int Area::getWrappingMaxWidth() const noexcept
@@ -210,6 +219,7 @@ void Area::setClearColor(RGBA32 color)
     _format.clear_color = Color(static_cast<uint32_t>((static_cast<uint32_t>(color.r) << 16)
         | (static_cast<uint32_t>(color.g) << 8)
         | static_cast<uint32_t>(color.b)));
+    _damageAll();
     _draw = true;
 }
 
@@ -281,54 +291,377 @@ static void jsonToFmt(nlohmann::json const& json, Format& fmt)
         fmt.tw_long_pauses = strToStr32(json.at("tw_long_pauses").get<std::string>());
 }
 
-static void _parseFmt(std::stack<Format>& fmts, std::u32string const& data)
+// Result of parsing a markup tag without building a JSON DOM
+enum class TagParse {
+    Applied,        // All keys were applied to the format
+    Empty,          // Empty object, closing the current format
+    Unsupported,    // Nested values, escapes, ... : needs the full JSON parser
+};
+
+// A scalar value of a flat JSON object, pointing into the parsed string
+struct TagValue {
+    enum class Type { String, Number, True, False, Null } type;
+    std::u32string_view text;   // Unquoted string or number literal
+};
+
+// Converts given number literal to an integer, if it is one
+template<typename T>
+static bool tagInteger(TagValue const& value, T& integer)
+{
+    if (value.type != TagValue::Type::Number || value.text.size() > 18)
+        return false;
+    long long n = 0;
+    size_t i = value.text[0] == U'-' ? 1 : 0;
+    if (i == value.text.size())
+        return false;
+    for (; i < value.text.size(); ++i) {
+        if (value.text[i] < U'0' || value.text[i] > U'9')
+            return false;
+        n = n * 10 + static_cast<long long>(value.text[i] - U'0');
+    }
+    integer = static_cast<T>(value.text[0] == U'-' ? -n : n);
+    return true;
+}
+
+// Whether given number literal follows the JSON grammar
+static bool isJsonNumber(std::u32string_view text) noexcept
+{
+    size_t i = 0;
+    auto const digits = [&]() {
+        size_t const first = i;
+        while (i < text.size() && text[i] >= U'0' && text[i] <= U'9')
+            ++i;
+        return i != first;
+    };
+    if (i < text.size() && text[i] == U'-')
+        ++i;
+    // No leading zeros
+    if (i < text.size() && text[i] == U'0')
+        ++i;
+    else if (!digits())
+        return false;
+    if (i < text.size() && text[i] == U'.') {
+        ++i;
+        if (!digits())
+            return false;
+    }
+    if (i < text.size() && (text[i] == U'e' || text[i] == U'E')) {
+        ++i;
+        if (i < text.size() && (text[i] == U'+' || text[i] == U'-'))
+            ++i;
+        if (!digits())
+            return false;
+    }
+    return i == text.size();
+}
+
+// Converts given number literal to a float, regardless of the locale
+static bool tagFloat(TagValue const& value, float& f)
+{
+    char buff[64];
+    if (value.type != TagValue::Type::Number || value.text.size() >= sizeof(buff))
+        return false;
+    // Number literals are ASCII
+    for (size_t i = 0; i < value.text.size(); ++i)
+        buff[i] = static_cast<char>(value.text[i]);
+    char const* const end = buff + value.text.size();
+    auto const result = std::from_chars(buff, end, f);
+    return result.ec == std::errc() && result.ptr == end;
+}
+
+// Enum names, matching NLOHMANN_JSON_SERIALIZE_ENUM() declarations above
+template<typename T>
+using TagEnumNames = std::initializer_list<std::pair<T, std::u32string_view>>;
+static TagEnumNames<Alignment> const alignment_names = {
+    { Alignment::Left, U"Left" },
+    { Alignment::Center, U"Center" },
+    { Alignment::Right, U"Right" },
+};
+static TagEnumNames<Effect> const effect_names = {
+    { Effect::None, U"None" },
+    { Effect::Vibrate, U"Vibrate" },
+    { Effect::Waves, U"Waves" },
+    { Effect::FadingWaves, U"FadingWaves" },
+};
+static TagEnumNames<ColorFunc> const color_func_names = {
+    { ColorFunc::None, U"None" },
+    { ColorFunc::Rainbow, U"Rainbow" },
+    { ColorFunc::RainbowFixed, U"RainbowFixed" },
+};
+
+// Converts given string value to an enum, unknown names being Invalid
+// as with their JSON serialization
+template<typename T>
+static bool tagEnum(TagValue const& value, T& e, TagEnumNames<T> const& names)
+{
+    if (value.type != TagValue::Type::String)
+        return false;
+    e = T::Invalid;
+    for (auto const& name : names) {
+        if (value.text == name.second) {
+            e = name.first;
+            break;
+        }
+    }
+    return true;
+}
+
+// Sets given format field from given scalar value, as jsonToFmt() would.
+// Returns false if the value needs the full JSON parser.
+static bool applyTagValue(std::u32string_view key, TagValue const& value, Format& fmt)
+{
+    using Type = TagValue::Type;
+    // Null values are ignored
+    if (value.type == Type::Null)
+        return true;
+    auto const is = [&key](std::u32string_view name) { return key == name; };
+    auto const to_bool = [&value](bool& b) {
+        if (value.type != Type::True && value.type != Type::False)
+            return false;
+        b = value.type == Type::True;
+        return true;
+    };
+    auto const to_string = [&value](std::string& str) {
+        if (value.type != Type::String)
+            return false;
+        str = str32ToStr(std::u32string(value.text));
+        return true;
+    };
+    auto const to_string32 = [&value](std::u32string& str) {
+        if (value.type != Type::String)
+            return false;
+        str = value.text;
+        return true;
+    };
+    // Replaces the color, as get<Color>() starts from a default one
+    auto const to_color = [&value](Color& color) {
+        uint32_t rgb;
+        if (tagInteger(value, rgb) && value.text[0] != U'-') {
+            color = Color{};
+            color.rgb = rgb;
+            color.func = ColorFunc::None;
+            return true;
+        }
+        ColorFunc func;
+        if (!tagEnum(value, func, color_func_names))
+            return false;
+        color = Color{};
+        if (func != ColorFunc::Invalid)
+            color.func = func;
+        return true;
+    };
+
+    // Font
+    if (is(U"font"))            return to_string(fmt.font);
+    // Style
+    if (is(U"charsize"))        return tagInteger(value, fmt.charsize);
+    if (is(U"has_outline"))     return to_bool(fmt.has_outline);
+    if (is(U"outline_size"))    return tagInteger(value, fmt.outline_size);
+    if (is(U"has_shadow"))      return to_bool(fmt.has_shadow);
+    if (is(U"shadow_offset_x")) return tagInteger(value, fmt.shadow_offset_x);
+    if (is(U"shadow_offset_y")) return tagInteger(value, fmt.shadow_offset_y);
+    if (is(U"line_spacing"))    return tagFloat(value, fmt.line_spacing);
+    if (is(U"alignment"))       return tagEnum(value, fmt.alignment, alignment_names);
+    if (is(U"effect"))          return tagEnum(value, fmt.effect, effect_names);
+    if (is(U"effect_offset"))   return tagInteger(value, fmt.effect_offset);
+    if (is(U"effect_speed"))    return tagInteger(value, fmt.effect_speed);
+    // Color
+    if (is(U"text_color"))      return to_color(fmt.text_color);
+    if (is(U"outline_color"))   return to_color(fmt.outline_color);
+    if (is(U"shadow_color"))    return to_color(fmt.shadow_color);
+    if (is(U"alpha"))           return tagInteger(value, fmt.alpha);
+    if (is(U"clear_color"))     return to_color(fmt.clear_color);
+    // Language
+    if (is(U"lng_tag"))         return to_string(fmt.lng_tag);
+    if (is(U"lng_script"))      return to_string(fmt.lng_script);
+    if (is(U"lng_direction"))   return to_string(fmt.lng_direction);
+    if (is(U"word_dividers"))   return to_string32(fmt.word_dividers);
+    if (is(U"tw_short_pauses")) return to_string32(fmt.tw_short_pauses);
+    if (is(U"tw_long_pauses"))  return to_string32(fmt.tw_long_pauses);
+    // Unknown keys are ignored
+    return true;
+}
+
+// Parses given flat JSON object of scalar values in a single pass,
+// applying each key directly to given format
+static TagParse parseTag(std::u32string_view data, Format& fmt)
 {
-    auto const json = nlohmann::json::parse(data);
+    size_t i = 0;
+    auto const skip_spaces = [&]() {
+        while (i < data.size() && (data[i] == U' ' || data[i] == U'\t' || data[i] == U'\n' || data[i] == U'\r'))
+            ++i;
+    };
+    auto const next_is = [&](char32_t c) {
+        skip_spaces();
+        if (i == data.size() || data[i] != c)
+            return false;
+        ++i;
+        return true;
+    };
+    // Reads a string without escape sequences, after its opening quote
+    auto const read_string = [&](std::u32string_view& str) {
+        size_t const end = data.find_first_of(U"\"\\", i);
+        if (end == std::u32string_view::npos || data[end] != U'"')
+            return false;
+        str = data.substr(i, end - i);
+        i = end + 1;
+        return true;
+    };
+    auto const read_literal = [&](std::u32string_view literal) {
+        if (data.substr(i, literal.size()) != literal)
+            return false;
+        i += literal.size();
+        return true;
+    };
 
-    if (json.empty() || json.is_null()) {
+    if (!next_is(U'{'))
+        return TagParse::Unsupported;
+    if (next_is(U'}')) {
+        skip_spaces();
+        return i == data.size() ? TagParse::Empty : TagParse::Unsupported;
+    }
+    do {
+        std::u32string_view key;
+        if (!next_is(U'"') || !read_string(key) || !next_is(U':'))
+            return TagParse::Unsupported;
+        skip_spaces();
+        if (i == data.size())
+            return TagParse::Unsupported;
+        TagValue value;
+        char32_t const c = data[i];
+        if (c == U'"') {
+            ++i;
+            value.type = TagValue::Type::String;
+            if (!read_string(value.text))
+                return TagParse::Unsupported;
+        }
+        else if (c == U'-' || (c >= U'0' && c <= U'9')) {
+            size_t const first = i;
+            while (i < data.size() && (data[i] == U'-' || data[i] == U'+' || data[i] == U'.'
+                || data[i] == U'e' || data[i] == U'E' || (data[i] >= U'0' && data[i] <= U'9')))
+            {
+                ++i;
+            }
+            value.type = TagValue::Type::Number;
+            value.text = data.substr(first, i - first);
+            // Let the JSON parser report malformed numbers
+            if (!isJsonNumber(value.text))
+                return TagParse::Unsupported;
+        }
+        else if (read_literal(U"true"))
+            value.type = TagValue::Type::True;
+        else if (read_literal(U"false"))
+            value.type = TagValue::Type::False;
+        else if (read_literal(U"null"))
+            value.type = TagValue::Type::Null;
+        else
+            return TagParse::Unsupported;
+        if (!applyTagValue(key, value, fmt))
+            return TagParse::Unsupported;
+    } while (next_is(U','));
+    if (!next_is(U'}'))
+        return TagParse::Unsupported;
+    skip_spaces();
+    return i == data.size() ? TagParse::Applied : TagParse::Unsupported;
+}
+
+// Applies given markup tag to the current format, or closes it if empty.
+// Resulting formats are cached by parent format & tag, as the same
+// few tags are usually applied to the same few formats.
+static void _parseFmt(std::stack<FormatId>& fmts, std::u32string_view data)
+{
+    struct Entry {
+        FormatId parent;    // Held so that its id isn't reused meanwhile
+        FormatId result;
+        std::list<std::u32string const*>::iterator lru; // Position in lru
+    };
+    static std::mutex mutex;
+    static std::unordered_map<std::u32string, Entry> cache;
+    static std::list<std::u32string const*> lru; // Most recently used first
+    static constexpr size_t max_cache_size = 4096;
+
+    // Key : parent format id, followed by the tag
+    thread_local std::u32string key;
+    key.assign(1, static_cast<char32_t>(fmts.top().value()));
+    key.append(data);
+    {
+        std::lock_guard<std::mutex> const lock(mutex);
+        auto const it = cache.find(key);
+        if (it != cache.cend()) {
+            lru.splice(lru.begin(), lru, it->second.lru);
+            fmts.push(it->second.result);
+            return;
+        }
+    }
+
+    FormatId const parent = fmts.top();
+    Format fmt = *parent;
+    TagParse result = parseTag(data, fmt);
+    if (result == TagParse::Unsupported) {
+        fmt = *fmts.top();
+        auto const json = nlohmann::json::parse(std::u32string(data));
+        if (json.empty() || json.is_null())
+            result = TagParse::Empty;
+        else
+            jsonToFmt(json, fmt);
+    }
+    if (result == TagParse::Empty) {
         if (fmts.size() > 1)
             fmts.pop();
         return;
     }
+    fmts.push(fmt);
 
-    fmts.push(fmts.top());
-    Format& fmt = fmts.top();
-
-    jsonToFmt(json, fmt);
+    std::lock_guard<std::mutex> const lock(mutex);
+    auto const [it, inserted] = cache.try_emplace(key, Entry{ parent, fmts.top() });
+    if (!inserted)
+        return;
+    lru.push_front(&it->first);
+    it->second.lru = lru.begin();
+    // Evict the least recently used entry
+    if (cache.size() > max_cache_size) {
+        cache.erase(cache.find(*lru.back()));
+        lru.pop_back();
+    }
 }
 
-void Area::parseStringU32(std::u32string const& str) try
+// Splits given markup string into parts, starting with given format
+static void parseParts(std::u32string_view view, FormatId fmt, std::vector<TextPart>& parts)
 {
-    history.clear();
-    std::vector<TextPart> parts;
-    std::stack<Format> fmts;
-    fmts.push(_format);
+    std::stack<FormatId> fmts;
+    fmts.push(fmt);
     size_t i = 0;
-    while (i != str.size()) {
-        size_t const opening_braces = str.find(U"{{", i);
+    while (i != view.size()) {
+        size_t const opening_braces = view.find(U"{{", i);
         if (opening_braces == std::string::npos) {
-            parts.emplace_back(str.substr(i), fmts.top());
+            parts.emplace_back(std::u32string(view.substr(i)), fmts.top());
             break;
         }
         else {
             // find closing braces
-            size_t const closing_braces = str.find(U"}}", opening_braces + 2);
+            size_t const closing_braces = view.find(U"}}", opening_braces + 2);
             if (closing_braces == std::string::npos) {
-                parts.emplace_back(str.substr(i), fmts.top());
+                parts.emplace_back(std::u32string(view.substr(i)), fmts.top());
                 break;
             }
             // add part if needed
             size_t diff = opening_braces - i;
             if (diff > 0)
-                parts.emplace_back(str.substr(i, diff), fmts.top());
+                parts.emplace_back(std::u32string(view.substr(i, diff)), fmts.top());
 
-           _parseFmt(fmts, str.substr(opening_braces + 1, closing_braces - opening_braces));
+           _parseFmt(fmts, view.substr(opening_braces + 1, closing_braces - opening_braces));
 
             // skip to next sub strings
             i = closing_braces + 2;
         }
     }
+}
 
+void Area::parseStringU32(std::u32string const& str) try
+{
+    history.clear();
+    std::vector<TextPart> parts;
+    parseParts(str, _format, parts);
     setTextParts(parts);
 }
 CATCH_AND_RETHROW_METHOD_EXC;
@@ -338,26 +671,186 @@ void Area::parseString(std::string const& str)
     parseStringU32(strToStr32(str));
 }
 
+void Area::appendStringU32(std::u32string const& str) try
+{
+    history.clear();
+    std::vector<TextPart> parts;
+    parseParts(str, _format, parts);
+    // Lines before the last two can't be modified by appending
+    size_t from = 0;
+    if (_lines.size() > 1)
+        from = (_lines.cend() - 2)->first_glyph;
+    for (TextPart const& part : parts) {
+        if (part.str.empty())
+            continue;
+        // Extend the last buffer if the format matches, only reshaping its end.
+        // Large ones are left as is once a line ends, as each update copies it.
+        _internal::Buffer& last = *_buffers.back();
+        std::u32string const& last_str = last.getString();
+        bool const is_large = last.glyphCount() >= _max_append_glyphs
+            && ((!last_str.empty() && last_str.back() == U'\n') || part.str.front() == U'\n');
+        if (last.getFormatId() == part.fmt && !is_large)
+            last.insertText(part.str, last.glyphCount());
+        else if (last.glyphCount() == 0)
+            last.set(part);
+        else
+            _buffers.push_back(std::make_unique<_internal::Buffer>(part));
+    }
+    _updateBufferInfos(from);
+    _evictLines();
+    _tw_cursor = std::min(_tw_cursor, static_cast<float>(_glyph_count));
+}
+CATCH_AND_RETHROW_METHOD_EXC;
+
+void Area::appendString(std::string const& str)
+{
+    appendStringU32(strToStr32(str));
+}
+
+void Area::setMaxLines(size_t max_lines)
+{
+    _max_lines = max_lines;
+    _evictLines();
+}
+
+// Removes the oldest lines exceeding _max_lines, along with their text.
+// Lines break on new lines, word dividers or glyphs, so following ones are
+// kept as is, only shifted up, unless removing the text changes the shaping.
+// Lines are removed once exceeding the maximum by an eighth, so that
+// shifting kept lines & buffers is amortized over appended lines.
+void Area::_evictLines() try
+{
+    if (_max_lines == 0 || _lines.size() <= _max_lines + _max_lines / 8)
+        return;
+    size_t const count = _lines.size() - _max_lines;
+    size_t const glyphs = _lines[count].first_glyph;
+    int const height = _lines[count - 1].scrolling;
+
+    // Remove evicted glyphs from the first buffers
+    size_t removed = 0;
+    while (removed < glyphs) {
+        _internal::Buffer& buffer = *_buffers.front();
+        size_t const glyph_count = buffer.glyphCount();
+        if (removed + glyph_count <= glyphs && _buffers.size() > 1) {
+            _buffers.erase(_buffers.begin());
+            removed += glyph_count;
+        }
+        else {
+            buffer.deleteText(0, buffer.getClusterIndex(glyphs - removed));
+            removed = glyphs;
+        }
+    }
+    size_t const old_glyph_count = _glyph_count;
+    _buffer_infos->update(_buffers);
+    _glyph_count = _buffer_infos->glyphCount();
+    _invalidateSnapshots(0, 0);
+
+    if (old_glyph_count - _glyph_count != glyphs) {
+        // Shaping changed, lay everything out again
+        _updateLines();
+    }
+    else {
+        // Shift remaining lines up, then update sizes from the last one
+        _lines.erase(_lines.cbegin(), _lines.cbegin() + static_cast<ptrdiff_t>(count));
+        int max_used_width = 0;
+        for (_internal::Line& line : _lines) {
+            line.first_glyph -= glyphs;
+            line.last_glyph -= glyphs;
+            line.scrolling -= height;
+            max_used_width = std::max(max_used_width, line.used_width);
+            line.max_used_width = max_used_width;
+        }
+        _pixels_h = std::max(_pixels_h - height, _h);
+        int const old_w = _w;
+        _reflowLines(_glyph_count, 0, _glyph_count);
+        // Drawn rows move up along with their text, only newly exposed ones
+        // are drawn again. Alignments depend on the width though.
+        if (_w != old_w) {
+            _damageAll();
+        }
+        else {
+            for (auto& pixels : _pixels) {
+                pixels->scrollUp(height);
+            }
+            _window_origin -= height;
+            _drawn_cursor_y -= height;
+        }
+    }
+    // Stay on the same text
+    _scrolling -= height;
+    _scrollingChanged();
+    auto const shift = [glyphs](size_t& cursor) {
+        cursor = cursor > glyphs ? cursor - glyphs : 0;
+    };
+    shift(_edit_cursor);
+    shift(_locked_cursor);
+    shift(_drawn_last_glyph);
+    shift(_drawn_selected_first);
+    shift(_drawn_selected_last);
+    _tw_cursor = std::max(0.f, _tw_cursor - static_cast<float>(glyphs));
+}
+CATCH_AND_RETHROW_METHOD_EXC;
+
 void Area::setTextParts(std::vector<TextPart> const& text_parts, bool move_cursor)
 {
     if (text_parts.empty()) {
         clear();
         return;
     }
-    _buffers.resize(text_parts.size());
-    
-    for (size_t i = 0; i < text_parts.size(); i++) {
-        auto const& part = text_parts.at(i);
-        auto& buffer = _buffers.at(i);
-        if (!buffer)
-            buffer = std::make_unique<_internal::Buffer>(part);
-        else
-            buffer->set(part);
+    // Empty parts get no buffer (see _updateBufferInfos()),
+    // skip them so that parts line up with the buffers they update
+    std::vector<TextPart const*> parts;
+    parts.reserve(text_parts.size());
+    for (TextPart const& part : text_parts) {
+        if (!part.str.empty())
+            parts.push_back(&part);
     }
+    if (parts.empty())
+        parts.push_back(&text_parts.front());
 
-    int const tmp = static_cast<int>(_glyph_count);
-    _updateBufferInfos();
-    int const diff = static_cast<int>(_glyph_count) - tmp;
+    // Leading & trailing parts matching their buffer are left untouched
+    auto const same = [](TextPart const& part, _internal::Buffer const& buffer) {
+        return part.fmt == buffer.getFormatId() && part.str == buffer.getString();
+    };
+    size_t const max_common = std::min(parts.size(), _buffers.size());
+    size_t prefix = 0;
+    while (prefix < max_common && same(*parts[prefix], *_buffers[prefix]))
+        ++prefix;
+    size_t suffix = 0;
+    while (suffix < max_common - prefix
+        && same(*parts[parts.size() - suffix - 1], *_buffers[_buffers.size() - suffix - 1]))
+    {
+        ++suffix;
+    }
+
+    int diff = 0;
+    // Identical parts skip shaping, layout & drawing altogether
+    if (prefix != parts.size() || prefix != _buffers.size()) {
+        // Update remaining buffers in place (only reshaping what changed in each),
+        // then insert or erase the extra ones
+        size_t const old_count = _buffers.size() - prefix - suffix;
+        size_t const new_count = parts.size() - prefix - suffix;
+        size_t const reused = std::min(old_count, new_count);
+        for (size_t i = prefix; i < prefix + reused; ++i) {
+            _buffers[i]->set(*parts[i]);
+        }
+        auto const it = _buffers.begin() + static_cast<ptrdiff_t>(prefix + reused);
+        if (old_count > new_count) {
+            _buffers.erase(it, it + static_cast<ptrdiff_t>(old_count - new_count));
+        }
+        else if (new_count > old_count) {
+            std::vector<_internal::Buffer::Ptr> added;
+            added.reserve(new_count - old_count);
+            for (size_t i = prefix + reused; i < prefix + new_count; ++i) {
+                added.push_back(std::make_unique<_internal::Buffer>(*parts[i]));
+            }
+            _buffers.insert(it, std::make_move_iterator(added.begin()), std::make_move_iterator(added.end()));
+        }
+
+        int const tmp = static_cast<int>(_glyph_count);
+        _updateBufferInfos();
+        diff = static_cast<int>(_glyph_count) - tmp;
+    }
     if (move_cursor) {
         if (_edit_cursor < _locked_cursor)
             _edit_cursor = _locked_cursor;
@@ -441,7 +934,7 @@ static std::string fmtDiff(Format const& parent, Format const& child)
 
 std::u32string Area::getUnparsedStringU32() const
 {
-    std::vector<Format> fmts;
+    std::vector<FormatId> fmts;
     fmts.emplace_back(_format);
     std::u32string ret;
 
@@ -449,15 +942,14 @@ std::u32string Area::getUnparsedStringU32() const
         auto const& buffer = *ptr;
         if (buffer.getString().empty())
             continue;
-        Format const buffer_fmt = buffer.getFormat();
+        FormatId const buffer_fmt = buffer.getFormatId();
         if (buffer_fmt == fmts.back()) {
             ret.append(buffer.getString());
             continue;
         }
         bool done = false;
         for (size_t i = 1; i < fmts.size(); ++i) {
-            Format const& fmt = fmts.at(fmts.size() - i - 1);
-            if (buffer_fmt == fmt) {
+            if (buffer_fmt == fmts.at(fmts.size() - i - 1)) {
                 for (size_t j = 0; j < i; ++j) {
                     ret.append(U"{{}}");
                 }
@@ -469,7 +961,7 @@ std::u32string Area::getUnparsedStringU32() const
         }
         if (done) continue;
 
-        ret.append(strToStr32(fmtDiff(fmts.back(), buffer_fmt)));
+        ret.append(strToStr32(fmtDiff(*fmts.back(), *buffer_fmt)));
         fmts.emplace_back(buffer_fmt);
 
         ret.append(buffer.getString());
@@ -485,6 +977,15 @@ std::string Area::getUnparsedString() const
 
 void Area::updateAll()
 {
+    _internal::Lib::nextFrame();
+    // Collect finished draws first, so that trimming glyphs doesn't discard them
+    for (Shared area : getInstances()) {
+        if ((*area->_processing_pixels)->collect())
+            area->_pixelsDrawn();
+    }
+    if (_internal::Lib::isOverGlyphBudget()) {
+        _trimGlyphs();
+    }
     for (Shared area : getInstances()) {
         area->_drawIfNeeded();
         area->_last_update = std::chrono::steady_clock::now();
@@ -495,10 +996,66 @@ void Area::cancelAll()
 {
     for (Shared area : getInstances()) {
         (*area->_processing_pixels)->cancel();
+        // Canceled draws took their damage with them, redraw everything
+        area->_damageAll();
+        area->_draw = true;
+    }
+}
+
+void Area::_trimGlyphs()
+{
+    // When the budget couldn't be reached, only retry once glyph memory grew
+    // by 1/16 of it, or after some frames (text changes may free glyphs)
+    size_t const memory = _internal::Lib::getGlyphMemory();
+    uint64_t const frame = _internal::Lib::getFrame();
+    if (_trim_failed_frame != 0 && frame - _trim_failed_frame < 60
+        && memory < _trim_failed_memory + _internal::Lib::getGlyphBudget() / 16)
+    {
+        return;
+    }
+    std::unordered_set<_internal::Bitmap const*> pinned;
+    auto const pin = [&pinned](std::vector<_internal::GlyphInfo> const& glyphs) {
+        for (_internal::GlyphInfo const& glyph : glyphs) {
+            pinned.insert(glyph.bitmap);
+            pinned.insert(glyph.outline);
+        }
+    };
+    for (Shared area : getInstances()) {
+        // Keep all glyphs of the area
+        for (_internal::BufferInfo const& buffer_info : *area->_buffer_infos) {
+            pin(buffer_info.glyphs);
+        }
+        for (auto const& buffer : area->_buffers) {
+            pin(buffer->getInfo().glyphs);
+        }
+    }
+    // Leave draws running if on-screen glyphs alone exceed the budget
+    if (_internal::Lib::canTrimGlyphs(pinned)) {
+        for (Shared area : getInstances()) {
+            // Queued & running draws may use bitmaps of older snapshots, restart them
+            if ((*area->_processing_pixels)->isRunning()) {
+                (*area->_processing_pixels)->cancel();
+                area->_damageAll();
+                area->_draw = true;
+            }
+        }
+        _internal::Lib::trimGlyphs(pinned);
+    }
+    if (_internal::Lib::isOverGlyphBudget()) {
+        _trim_failed_memory = _internal::Lib::getGlyphMemory();
+        _trim_failed_frame = frame;
+    }
+    else {
+        _trim_failed_frame = 0;
     }
 }
 
 void Area::_subjectUpdate(Subject const& subject, Event const& event)
+{
+    // Finished draws are collected in updateAll()
+}
+
+void Area::_pixelsDrawn()
 {
     bool const resize = (*_current_pixels)->sizeDiff(*(*_processing_pixels));
     _current_pixels = _processing_pixels;
@@ -512,11 +1069,14 @@ void const* Area::pixelsGet() const try
         return nullptr;
     }
     // Retrieve cropped dimensions of current pixels
-    int w, h;
+    int w, h, origin, window_h;
     (*_current_pixels)->getDimensions(w, h);
+    (*_current_pixels)->getWindow(origin, window_h);
     size_t size = static_cast<size_t>(w) * static_cast<size_t>(h);
+    // Rasterized window may lag behind scrolling until the next draw
+    int const row = std::clamp(_scrolling - origin, 0, std::max(0, window_h - h));
     // Ensure current scrolling doesn't go past the pixels vector
-    size_t const index = static_cast<size_t>(_scrolling) * static_cast<size_t>(w);
+    size_t const index = static_cast<size_t>(row) * static_cast<size_t>(w);
     if (index > pixels.size() - size) {
         throw_exc("Scrolling error");
     }
@@ -556,6 +1116,26 @@ void Area::getDimensions(int& width, int& height) const noexcept
     height = _h;
 }
 
+void Area::setDrawPriority(int priority) noexcept
+{
+    _draw_priority = priority;
+}
+
+void Area::setVirtualized(bool virtualized) noexcept
+{
+    if (_virtualized != virtualized) {
+        _virtualized = virtualized;
+        _draw = true;
+    }
+}
+
+void Area::setOverscan(int pixels) noexcept
+{
+    _overscan = std::max(0, pixels);
+    if (_virtualized)
+        _draw = true;
+}
+
 void Area::setDimensions(int width, int height) try
 {
     _w = width;
@@ -576,6 +1156,9 @@ void Area::scroll(int pixels) noexcept
     _scrolling += pixels;
     _scrollingChanged();
     if (tmp != _scrolling) {
+        // Render newly exposed lines
+        if (_windowNeedsUpdate())
+            _draw = true;
         EMIT_EVENT("SSS_TR_CONTENT");
     }
 }
@@ -633,6 +1216,32 @@ bool Area::isFocused() const noexcept
     return focused && focused == shared_from_this();
 }
 
+// Returns the cursor closest to given x (26.6) on given line, reading
+// glyph positions from the display list. Clicks on the leading half
+// of a glyph place the cursor before it, and after it otherwise.
+static size_t hitTestLine(_internal::AreaSnapshot const& snapshot, _internal::Line const& line, FT_Pos x)
+{
+    size_t cursor = line.last_glyph;
+    FT_Pos best = std::numeric_limits<FT_Pos>::max();
+    auto it = snapshot.buffer_infos.getGlyphIterator(line.first_glyph);
+    for (size_t i = line.first_glyph; i < line.last_glyph && i < snapshot.glyphs.size(); ++i, ++it) {
+        FT_Pos const advance = it.glyph().pos.x_advance;
+        if (advance == 0)
+            continue;
+        // RTL glyphs are drawn left of their pen
+        _internal::PositionedGlyph const& glyph = snapshot.glyphs[i];
+        FT_Pos const x0 = glyph.is_ltr ? glyph.bg_pen.x : glyph.bg_pen.x - advance;
+        FT_Pos const distance = x < x0 ? x0 - x : std::max<FT_Pos>(0, x - x0 - advance);
+        if (distance < best) {
+            best = distance;
+            cursor = (x < x0 + advance / 2) == glyph.is_ltr ? i : i + 1;
+            if (distance == 0)
+                break;
+        }
+    }
+    return cursor;
+}
+
 void Area::cursorPlace(int x, int y) try
 {
     setFocus(true);
@@ -642,70 +1251,15 @@ void Area::cursorPlace(int x, int y) try
     }
     y += _scrolling;
 
-    _internal::Line::cit line = _lines.cbegin();
-    FT_Vector pen;
-    pen.x = (_buffer_infos->isLTR() ? _margin_v : (_w - _margin_v)) << 6;
-    pen.y = _margin_h;
-    for (; line != _lines.cend(); ++line) {
-        pen.y += line->fullsize;
-        if (pen.y > y) break;
-    }
-    if (line == _lines.cend()) {
-        --line;
+    if (!_snapshot) {
+        _updateSnapshot();
     }
-
-    bool click_is_ltr = _buffer_infos->isLTR();
-    bool i_is_ltr = click_is_ltr;
-    pen.x += (line->x_offset(_buffer_infos->isLTR()) << 6) * (i_is_ltr ? 1 : -1);
-
-
-    auto const select_text = [&]() {
-        if (!_lock_selection) {
-            _locked_cursor = _edit_cursor;
-            lockSelection();
-        }
-    };
-    // Do some magic
-    for (size_t i = line->first_glyph; i < line->last_glyph; ++i) {
-        // Get glyph info
-        _internal::GlyphInfo const& glyph(_buffer_infos->getGlyph(i));
-
-        // Check if text direction changed between previous glyphs
-        if ((_buffer_infos->getBuffer(i).fmt.lng_direction == "ltr") != i_is_ltr) {
-            // Check that click coordinates aren't on this specific glyph
-            int clicked_x = (pen.x + glyph.pos.x_advance) >> 6;
-            if (click_is_ltr ? (clicked_x > x) : (clicked_x < x)) {
-                _edit_cursor = i;
-                select_text();
-                return;
-            }
-            // Replace pen to make up for direction changes
-            line->replace_pen(pen, *_buffer_infos, i);
-            // Update direction of cursor
-            i_is_ltr = !i_is_ltr;
-            // Update direction of click area if needed
-            clicked_x = (pen.x - glyph.pos.x_advance) >> 6;
-            if (click_is_ltr ? (clicked_x > x) : (clicked_x < x)) {
-                click_is_ltr = !click_is_ltr;
-            }
-        }
-
-        // Advance before computing X if RTL
-        if (!i_is_ltr)
-            pen.x -= glyph.pos.x_advance;
-        // Compute X and test if it matches the click coordinates
-        int const clicked_x = (pen.x + glyph.pos.x_advance / 2) >> 6;
-        if (click_is_ltr ? (clicked_x > x) : (clicked_x < x)) {
-            _edit_cursor = i;
-            select_text();
-            return;
-        }
-        // Advance after computing X if LTR
-        if (i_is_ltr)
-            pen.x += glyph.pos.x_advance;
+    _internal::Line::cit const line = _internal::Line::atHeight(_lines, y - _margin_h);
+    _edit_cursor = hitTestLine(*_snapshot, *line, static_cast<FT_Pos>(x) << 6);
+    if (!_lock_selection) {
+        _locked_cursor = _edit_cursor;
+        lockSelection();
     }
-    _edit_cursor = line->last_glyph;
-    select_text();
 }
 CATCH_AND_RETHROW_METHOD_EXC;
 
@@ -773,37 +1327,10 @@ size_t Area::_move_cursor_line(_internal::Line const* line, int x)
         _edit_x = x;
     else
         x = _edit_x;
-    size_t cursor = line->first_glyph;
-    size_t const glyph_count = _buffer_infos->glyphCount();
-    bool line_is_ltr = _buffer_infos->isLTR();
-    bool is_ltr = line_is_ltr;
-    for (int new_x = (is_ltr ? (_margin_h + line->x_offset(_buffer_infos->isLTR())) :
-        (_w - _margin_h - line->x_offset(_buffer_infos->isLTR()))) << 6;
-        cursor < line->last_glyph && cursor < glyph_count;
-        ++cursor)
-    {
-        int const offset = _buffer_infos->getGlyph(cursor).pos.x_advance;
-        if ((_buffer_infos->getBuffer(cursor).fmt.lng_direction == "ltr") != is_ltr) {
-            // Check that click coordinates aren't on this specific glyph
-            int clicked_x = (x + offset) >> 6;
-            if (line_is_ltr ? (clicked_x > x) : (clicked_x < x)) {
-                break;
-            }
-            FT_Vector pen{ new_x, 0 };
-            line->replace_pen(pen, *_buffer_infos, cursor);
-            new_x = pen.x;
-            is_ltr = !is_ltr;
-            clicked_x = (pen.x - offset) >> 6;
-            if (line_is_ltr ? (clicked_x > x) : (clicked_x < x)) {
-                line_is_ltr = !line_is_ltr;
-            }
-        }
-        if (line_is_ltr ? (((new_x + offset / 2) >> 6) > x) : (((new_x - offset / 2) >> 6) < x)) {
-            break;
-        }
-        new_x += offset * (is_ltr ? 1 : -1);
+    if (!_snapshot) {
+        _updateSnapshot();
     }
-    return cursor;
+    return hitTestLine(*_snapshot, *line, static_cast<FT_Pos>(x) << 6);
 }
 
 static size_t _ctrl_jump(_internal::BufferInfoVector const& buffer_infos,
@@ -1109,6 +1636,7 @@ void Area::setPrintMode(PrintMode mode) noexcept
     }
     _tw_cursor = 0.f;
     _print_mode = mode;
+    _damageAll();
     _draw = true;
 }
 
@@ -1117,31 +1645,45 @@ void Area::setTypeWriterSpeed(int char_per_second)
     _tw_cps = char_per_second;
 }
 
-void Area::_getCursorPhysicalPos(int& x, int& y) const noexcept
+void Area::_getCursorPhysicalPos(int& x, int& y)
 {
-    _internal::Line::cit line(_internal::Line::which(_lines, _edit_cursor));
+    _internal::Line::cit const line(_internal::Line::which(_lines, _edit_cursor));
+    y = _margin_h + line->scrolling;
 
-    FT_Vector pen;
-    pen.y = _margin_h;
-    for (_internal::Line::cit it = _lines.cbegin(); it <= line; ++it) {
-        pen.y += it->fullsize;
+    // Read the pen from the display list
+    if (!_snapshot) {
+        _updateSnapshot();
+    }
+    std::vector<_internal::PositionedGlyph> const& glyphs = _snapshot->glyphs;
+    // After the previous glyph of the line
+    if (_edit_cursor > line->first_glyph && _edit_cursor <= glyphs.size()) {
+        _internal::PositionedGlyph const& glyph = glyphs[_edit_cursor - 1];
+        FT_Pos const advance = _buffer_infos->getGlyph(_edit_cursor - 1).pos.x_advance;
+        x = (glyph.bg_pen.x + advance * (glyph.is_ltr ? 1 : -1)) >> 6;
+    }
+    // Before the first glyph of the line
+    else if (_edit_cursor < glyphs.size()) {
+        x = glyphs[_edit_cursor].bg_pen.x >> 6;
+    }
+    // Empty line
+    else {
+        int const x_offset = _margin_v + line->x_offset(_buffer_infos->isLTR());
+        x = _buffer_infos->isLTR() ? x_offset : _w - x_offset;
     }
+}
 
-    bool is_ltr = _buffer_infos->isLTR();
-    if (is_ltr)
-        pen.x = (_margin_v + line->x_offset(_buffer_infos->isLTR())) << 6;
-    else
-        pen.x = (_w - _margin_v - line->x_offset(_buffer_infos->isLTR())) << 6;
-    for (size_t n = line->first_glyph; n < _edit_cursor && n < _glyph_count; ++n) {
-        auto const& buffer = _buffer_infos->getBuffer(n);
-        if ((buffer.fmt.lng_direction == "ltr") != is_ltr) {
-            is_ltr = !is_ltr;
-            line->replace_pen(pen, *_buffer_infos, n);
-        }
-        pen.x += _buffer_infos->getGlyph(n).pos.x_advance * (is_ltr ? 1 : -1);
+bool Area::_windowNeedsUpdate() const noexcept
+{
+    if (!_virtualized) {
+        return false;
     }
-    x = pen.x >> 6;
-    y = pen.y;
+    // Re-center when the visible window enters the outer half of the overscan,
+    // unless the rasterized window already reaches the text's edge
+    int const margin = _overscan / 2;
+    int const window_end = _window_origin + _window_h;
+    int const top = _window_origin > 0 ? _window_origin + margin : 0;
+    int const bottom = window_end < _pixels_h ? window_end - margin : window_end;
+    return _scrolling < top || _scrolling + _h > bottom;
 }
 
 // Ensures _scrolling has a valid value
@@ -1157,8 +1699,22 @@ void Area::_scrollingChanged() noexcept
 }
 
 // Updates _lines
-void Area::_updateLines() try
+void Area::_updateLines(bool damage_all) try
+{
+    _reflowLines(0, 0, _glyph_count);
+    if (damage_all)
+        _damageAll();
+}
+CATCH_AND_RETHROW_METHOD_EXC;
+
+// Re-breaks _lines from the one before the line holding the first modified glyph.
+// Once a new line matches an old one within the unmodified trailing glyphs,
+// the following old lines are shifted instead of being re-measured.
+int Area::_reflowLines(size_t first, size_t suffix, size_t old_glyph_count) try
 {
+    int const old_w = _w;
+    // Height from which lines are unchanged, if any
+    int unchanged_y = INT_MAX;
     if (_wrapping) {
         _w = _margin_v * 2;
         _h = _margin_h * 2;
@@ -1166,31 +1722,57 @@ void Area::_updateLines() try
     else if (_glyph_count > 0 && (_w <= 0 || _h <= 0)) {
         throw_exc("wrapping disabled but width and/or height <= 0");
     }
-    // Reset _lines
-    _lines.clear();
-    _lines.emplace_back();
-    _internal::Line::it line = _lines.begin();
     if (_buffer_infos->empty()) {
+        _invalidateSnapshots(0);
+        _lines.clear();
+        _lines.emplace_back();
+        _internal::Line::it const line = _lines.begin();
         line->alignment = _format.alignment;
         line->charsize = _format.charsize;
         line->fullsize = static_cast<int>(static_cast<float>(_format.charsize) * _format.line_spacing);
-        return;
+        return unchanged_y;
     }
-    
-    Alignment const main_alignment = _buffer_infos->front().fmt.alignment;
-    line->alignment = main_alignment;
+
+    Alignment const main_alignment = _buffer_infos->front().fmt->alignment;
     size_t cursor = 0;
+    bool add_line = false;
+    // Old lines from the first re-broken one, and the glyph count difference
+    _internal::Line::vector old_lines;
+    ptrdiff_t const delta = static_cast<ptrdiff_t>(_glyph_count) - static_cast<ptrdiff_t>(old_glyph_count);
+    // Changes may pull glyphs back onto the previous line
+    size_t start = _lines.empty() ? 0 : _internal::Line::which(_lines, first) - _lines.cbegin();
+    if (start > 0)
+        --start;
+    _invalidateSnapshots(start);
+    if (start > 0) {
+        old_lines.assign(_lines.cbegin() + start, _lines.cend());
+        _lines.resize(start);
+        cursor = old_lines.front().first_glyph;
+        add_line = true;
+    }
+    else {
+        _lines.clear();
+        _lines.emplace_back();
+        _lines.front().alignment = main_alignment;
+    }
+    _internal::Line::it line = _lines.end() - 1;
+    // Lines may only re-synchronize past the modified glyphs
+    size_t const sync_glyph = _glyph_count - std::min(suffix, _glyph_count);
+    _internal::Line::cit old_line = old_lines.cbegin();
+    bool synced = false;
 
     size_t last_divider(0);
     int last_divider_x{ 0 };
     FT_Vector pen({ _margin_v << 6, _margin_h << 6 });
 
-    bool add_line = false;
-    
-    while (cursor < _glyph_count) {
+    _internal::BufferInfoVector::GlyphIterator glyph_it = _buffer_infos->getGlyphIterator(cursor);
+    while (cursor < _glyph_count && !synced) {
+        // Re-seek iterator if the cursor went back to a line break
+        if (glyph_it.cursor() != cursor)
+            glyph_it = _buffer_infos->getGlyphIterator(cursor);
         // Retrieve glyph infos
-        _internal::GlyphInfo const& glyph = _buffer_infos->getGlyph(cursor);
-        _internal::BufferInfo const& buffer = _buffer_infos->getBuffer(cursor);
+        _internal::GlyphInfo const& glyph = glyph_it.glyph();
+        _internal::BufferInfo const& buffer = glyph_it.buffer();
 
         // Add line if needed
         if (add_line) {
@@ -1198,19 +1780,19 @@ void Area::_updateLines() try
             line = _lines.end() - 1;
             line->first_glyph = cursor;
             line->scrolling = (line - 1)->scrolling;
-            line->alignment = buffer.fmt.alignment;
+            line->alignment = buffer.fmt->alignment;
             // Reset pen
             pen = { _margin_v << 6, _margin_h << 6 };
             add_line = false;
         }
 
         // Update sizes
-        int const charsize = buffer.fmt.charsize;
+        int const charsize = buffer.fmt->charsize;
         if (line->charsize < charsize) {
             line->charsize = charsize;
         }
         int const fullsize = static_cast<int>(static_cast<float>(charsize) *
-            buffer.fmt.line_spacing);
+            buffer.fmt->line_spacing);
         if (line->fullsize < fullsize) {
             line->fullsize = fullsize;
             line->y_offset = (fullsize - static_cast<int>(1.3f *
@@ -1222,7 +1804,7 @@ void Area::_updateLines() try
             last_divider = cursor;
             last_divider_x = pen.x;
         }
-        else if (line->alignment != buffer.fmt.alignment && buffer.fmt.alignment == main_alignment) {
+        else if (line->alignment != buffer.fmt->alignment && buffer.fmt->alignment == main_alignment) {
             line->alignment = main_alignment;
         }
         // Update pen position
@@ -1250,43 +1832,76 @@ void Area::_updateLines() try
             line->last_glyph = cursor;
             line->scrolling += line->fullsize;
             line->used_width += _margin_v;
-            if (_wrapping && _w < line->used_width) {
-                _w = line->used_width;
-            }
             last_divider = 0;
             last_divider_x = 0;
             add_line = true;
+            // Shift following old lines if this one is unchanged
+            if (line->first_glyph >= sync_glyph) {
+                size_t const old_first = static_cast<size_t>(static_cast<ptrdiff_t>(line->first_glyph) - delta);
+                while (old_line != old_lines.cend() && old_line->first_glyph < old_first)
+                    ++old_line;
+                if (old_line != old_lines.cend() && old_line != old_lines.cend() - 1
+                    && old_line->first_glyph == old_first
+                    && static_cast<ptrdiff_t>(old_line->last_glyph) + delta == static_cast<ptrdiff_t>(line->last_glyph)
+                    && old_line->fullsize == line->fullsize && old_line->y_offset == line->y_offset
+                    && old_line->charsize == line->charsize && old_line->used_width == line->used_width
+                    && old_line->alignment == line->alignment)
+                {
+                    int const shift = line->scrolling - old_line->scrolling;
+                    // Lines from this one are left in place : glyphs overflowing
+                    // from the previous line are the last ones to redraw
+                    if (shift == 0 && line != _lines.begin())
+                        unchanged_y = line->scrolling - line->fullsize + (line - 1)->charsize;
+                    for (++old_line; old_line != old_lines.cend(); ++old_line) {
+                        _internal::Line& shifted = _lines.emplace_back(*old_line);
+                        shifted.first_glyph = static_cast<size_t>(static_cast<ptrdiff_t>(shifted.first_glyph) + delta);
+                        shifted.last_glyph = static_cast<size_t>(static_cast<ptrdiff_t>(shifted.last_glyph) + delta);
+                        shifted.scrolling += shift;
+                    }
+                    line = _lines.end() - 1;
+                    synced = true;
+                }
+            }
         }
         // Only increment cursor if not a line break
         ++cursor;
+        ++glyph_it;
+    }
+
+    if (!synced) {
+        line->last_glyph = cursor;
+        // Add line size if empty (for input visibility)
+        if (line->first_glyph == line->last_glyph) {
+            auto const& buffer = _buffer_infos->getBuffer(cursor);
+            line->charsize = buffer.fmt->charsize;
+            line->fullsize = static_cast<int>(static_cast<float>(line->charsize) *
+                buffer.fmt->line_spacing);
+            line->y_offset = (line->fullsize - static_cast<int>(1.3f *
+                static_cast<float>(line->charsize))) / 2;
+        }
+        line->scrolling += line->fullsize;
+        line->used_width = (pen.x >> 6) + _margin_v;
     }
-
-    line->last_glyph = cursor;
-    // Add line size if empty (for input visibility)
-    if (line->first_glyph == line->last_glyph) {
-        auto const& buffer = _buffer_infos->getBuffer(cursor);
-        line->charsize = buffer.fmt.charsize;
-        line->fullsize = static_cast<int>(static_cast<float>(line->charsize) *
-            buffer.fmt.line_spacing);
-        line->y_offset = (line->fullsize - static_cast<int>(1.3f *
-            static_cast<float>(line->charsize))) / 2;
+    // Highest used width up to each line, from the first re-broken one
+    for (auto it = _lines.begin() + static_cast<ptrdiff_t>(start); it != _lines.end(); ++it) {
+        it->max_used_width = it == _lines.begin() ? it->used_width
+            : std::max((it - 1)->max_used_width, it->used_width);
     }
-    line->scrolling += line->fullsize;
-    line->used_width = (pen.x >> 6) + _margin_v;
     if (_wrapping) {
-        if (_w < (line->used_width)) {
-            _w = line->used_width;
-        }
-        ++_w;
+        _w = std::max(_w, _lines.back().max_used_width) + 1;
+        _h += _lines.back().scrolling;
     }
     if (_w < _min_w)
         _w = _min_w;
+    // Alignments depend on the width
+    if (_w != old_w) {
+        unchanged_y = INT_MAX;
+        start = 0;
+        _invalidateSnapshots(0);
+    }
     // Compute unused width of each line
-    for (auto& line : _lines) {
-        line.unused_width = _w - line.used_width;
-        if (_wrapping) {
-            _h += static_cast<int>(line.fullsize);
-        }
+    for (auto it = _lines.begin() + static_cast<ptrdiff_t>(start); it != _lines.end(); ++it) {
+        it->unused_width = _w - it->used_width;
     }
     // Update size & scrolling
     size_t const size_before = _pixels_h;
@@ -1300,28 +1915,181 @@ void Area::_updateLines() try
         _scrollingChanged();
     }
     _draw = true;
+    return unchanged_y;
 }
 CATCH_AND_RETHROW_METHOD_EXC;
 
-// Updates _buffer_infos and _glyph_count, then calls _updateLines();
-void Area::_updateBufferInfos() try
+// Updates the snapshot which no draw uses from _buffer_infos & _lines,
+// positioning glyphs from the first line modified since its last update
+void Area::_updateSnapshot()
+{
+    size_t slot = _snapshot_slot;
+    if (slot == _drawn_slot && (*_processing_pixels)->isRunning())
+        slot = 1 - slot;
+    std::shared_ptr<_internal::AreaSnapshot>& snapshot = _snapshots[slot];
+    if (!snapshot)
+        snapshot = std::make_shared<_internal::AreaSnapshot>();
+    snapshot->update(*_buffer_infos, _lines, _w, _margin_v, _margin_h);
+    _snapshot_slot = slot;
+    _snapshot = snapshot;
+}
+
+void Area::_invalidateSnapshots(size_t first_line, size_t first_run) noexcept
 {
+    _snapshot.reset();
+    for (auto& snapshot : _snapshots) {
+        if (snapshot)
+            snapshot->invalidate(first_line, first_run);
+    }
+}
+
+// Updates _buffer_infos and _glyph_count, then re-breaks modified lines
+void Area::_updateBufferInfos(size_t from) try
+{
+    // Buffers before the one holding the first compared glyph are unmodified
+    size_t const first_buffer = _buffer_infos->getBufferIndex(from);
     if (!_buffers.empty()) {
-        for (auto it = _buffers.cbegin() + 1; it != _buffers.cend(); ) {
+        size_t const first_erased = std::max<size_t>(first_buffer, 1);
+        for (auto it = _buffers.cbegin() + static_cast<ptrdiff_t>(first_erased); it != _buffers.cend(); ) {
             if ((*it)->glyphCount() == 0)
                 it = _buffers.erase(it);
             else
                 ++it;
         }
-        if (_buffers.size() > 1 && _buffers.front()->glyphCount() == 0)
+        if (first_buffer == 0 && _buffers.size() > 1 && _buffers.front()->glyphCount() == 0)
             _buffers.erase(_buffers.cbegin());
     }
-    _buffer_infos->update(_buffers);
+    // Keep previous infos from there to determine which part was modified
+    _internal::BufferInfoVector const old_infos = _buffer_infos->tail(first_buffer);
+    size_t const old_glyph_count = _glyph_count;
+    _buffer_infos->update(_buffers, first_buffer);
     _glyph_count = _buffer_infos->glyphCount();
-    _updateLines();
+    _invalidateSnapshots(SIZE_MAX, first_buffer);
+    size_t const first = _buffer_infos->firstDifference(old_infos, from);
+    // Trailing unmodified glyphs may not overlap the leading ones.
+    // Appended text has none, skip comparing the whole text then.
+    size_t const common = std::min(_glyph_count, old_glyph_count);
+    size_t const suffix = first_buffer == 0
+        ? std::min(_buffer_infos->commonSuffix(old_infos), common - std::min(first, common))
+        : 0;
+    bool const modified = first < std::max(_glyph_count, old_glyph_count);
+    int y0 = INT_MAX;
+    if (modified && !_lines.empty()) {
+        _internal::Line::cit const line = _internal::Line::which(_lines, first);
+        y0 = line->scrolling - line->fullsize - line->charsize;
+    }
+    int const old_w = _w, old_pixels_h = _pixels_h;
+    int const y1 = _reflowLines(first, suffix, old_glyph_count);
+
+    // Layout-only changes move lines without modifying glyphs
+    if (!modified) {
+        if (_w != old_w || _pixels_h != old_pixels_h)
+            _damageAll();
+    }
+    // Redraw from the line holding the first modified glyph,
+    // to the bottom or the first line left in place
+    else {
+        _internal::Line::cit const line = _internal::Line::which(_lines, first);
+        y0 = std::min(y0, line->scrolling - line->fullsize - line->charsize);
+        _damageRect(0, _margin_h + y0, INT_MAX, y1 == INT_MAX ? INT_MAX : _margin_h + y1);
+    }
 }
 CATCH_AND_RETHROW_METHOD_EXC;
 
+void Area::_damageAll() noexcept
+{
+    for (auto& pixels : _pixels) {
+        pixels->addDamage();
+    }
+}
+
+void Area::_damageRect(int x0, int y0, int x1, int y1) noexcept
+{
+    _internal::Rect const rect{ x0, y0, x1, y1 };
+    for (auto& pixels : _pixels) {
+        pixels->addDamage(rect);
+    }
+}
+
+void Area::_damageGlyphs(size_t first, size_t last, int padding) noexcept
+{
+    // Lines are padded by their charsize, as glyphs may overflow them
+    _internal::Line::cit line = _internal::Line::which(_lines, first);
+    int const y0 = line->scrolling - line->fullsize - line->charsize;
+    line = _internal::Line::which(_lines, last);
+    int const y1 = line->scrolling + line->charsize;
+    _damageRect(0, _margin_h + y0 - padding, INT_MAX, _margin_h + y1 + padding);
+}
+
+void Area::_damageDrawState(_internal::AreaData const& data) noexcept
+{
+    // Cursor box, previous and current
+    if (data.draw_cursor != _drawn_cursor || (data.draw_cursor
+        && (data.cursor_x != _drawn_cursor_x || data.cursor_y != _drawn_cursor_y
+            || data.cursor_h != _drawn_cursor_h)))
+    {
+        if (_drawn_cursor) {
+            _damageRect(_drawn_cursor_x, _drawn_cursor_y - _drawn_cursor_h,
+                _drawn_cursor_x + 2, _drawn_cursor_y);
+        }
+        if (data.draw_cursor) {
+            _damageRect(data.cursor_x, data.cursor_y - data.cursor_h,
+                data.cursor_x + 2, data.cursor_y);
+        }
+        _drawn_cursor = data.draw_cursor;
+        _drawn_cursor_x = data.cursor_x;
+        _drawn_cursor_y = data.cursor_y;
+        _drawn_cursor_h = data.cursor_h;
+    }
+    // Glyphs whose selection state changed
+    size_t const first = data.selected.state ? data.selected.first : 0;
+    size_t const last = data.selected.state ? data.selected.last : 0;
+    if (first != _drawn_selected_first || last != _drawn_selected_last) {
+        if (_drawn_selected_first == _drawn_selected_last) {
+            _damageGlyphs(first, last);
+        }
+        else if (first == last) {
+            _damageGlyphs(_drawn_selected_first, _drawn_selected_last);
+        }
+        else {
+            if (first != _drawn_selected_first)
+                _damageGlyphs(std::min(first, _drawn_selected_first), std::max(first, _drawn_selected_first));
+            if (last != _drawn_selected_last)
+                _damageGlyphs(std::min(last, _drawn_selected_last), std::max(last, _drawn_selected_last));
+        }
+        _drawn_selected_first = first;
+        _drawn_selected_last = last;
+    }
+    // Glyphs revealed or hidden by the typewriter
+    if (data.last_glyph != _drawn_last_glyph) {
+        _damageGlyphs(std::min(data.last_glyph, _drawn_last_glyph),
+            std::max(data.last_glyph, _drawn_last_glyph));
+        _drawn_last_glyph = data.last_glyph;
+    }
+    // Animated glyphs change on every frame
+    if (!(_buffer_infos->getFlags() & (_internal::RUN_VIBRATING | _internal::RUN_ANIMATED)))
+        return;
+    for (size_t i = 0; i < _buffer_infos->size(); ++i) {
+        _internal::BufferInfo const& buffer = _buffer_infos->at(i);
+        Format const& fmt = buffer.fmt;
+        if (buffer.glyphs.empty() || (fmt.effect == Effect::None
+            && fmt.text_color.func != ColorFunc::Rainbow
+            && fmt.outline_color.func != ColorFunc::Rainbow
+            && fmt.shadow_color.func != ColorFunc::Rainbow
+            && fmt.clear_color.func != ColorFunc::Rainbow))
+        {
+            continue;
+        }
+        int padding = std::abs(fmt.effect_offset);
+        if (fmt.has_outline)
+            padding += fmt.outline_size;
+        if (fmt.has_shadow)
+            padding += std::max(std::abs(fmt.shadow_offset_x), std::abs(fmt.shadow_offset_y));
+        size_t const first_glyph = _buffer_infos->getFirstGlyph(i);
+        _damageGlyphs(first_glyph, first_glyph + buffer.glyphs.size() - 1, padding);
+    }
+}
+
 // Draws current area if _draw is set to true
 void Area::_drawIfNeeded()
 {
@@ -1355,7 +2123,7 @@ void Area::_drawIfNeeded()
                 ++first)
             {
                 char32_t const c = _buffer_infos->getChar(first);
-                auto const& fmt = _buffer_infos->getBuffer(first).fmt;
+                Format const& fmt = _buffer_infos->getBuffer(first).fmt;
                 for (size_t i = 0;
                     i < fmt.tw_short_pauses.size() && i < fmt.tw_long_pauses.size();
                     i++)
@@ -1392,22 +2160,13 @@ void Area::_drawIfNeeded()
     }
     // Determine if a function needs to be edited
     if (!_draw) {
-        for (auto const& buffer : *_buffer_infos) {
-            if (buffer.fmt.effect == Effect::Vibrate) {
-                if (now - _last_vibrate_update >= 33ms) {
-                    _last_vibrate_update = now;
-                    _draw = true;
-                    break;
-                }
-            }
-            if ((buffer.fmt.effect != Effect::None && buffer.fmt.effect != Effect::Vibrate)
-                || buffer.fmt.text_color.func == ColorFunc::Rainbow
-                || (buffer.fmt.has_outline && buffer.fmt.outline_color.func == ColorFunc::Rainbow)
-                || (buffer.fmt.has_shadow && buffer.fmt.shadow_color.func == ColorFunc::Rainbow))
-            {
-                _draw = true;
-                break;
-            }
+        uint32_t const flags = _buffer_infos->getFlags();
+        if ((flags & _internal::RUN_VIBRATING) && now - _last_vibrate_update >= 33ms) {
+            _last_vibrate_update = now;
+            _draw = true;
+        }
+        else if (flags & _internal::RUN_ANIMATED) {
+            _draw = true;
         }
     }
     // Skip if drawing is not needed
@@ -1431,8 +2190,25 @@ void Area::_drawIfNeeded()
     data.w = _w;
     data.h = _h;
     data.pixels_h = _pixels_h;
+    if (_virtualized) {
+        data.origin = std::max(0, _scrolling - _overscan);
+        data.window_h = std::min(_pixels_h, _scrolling + _h + _overscan) - data.origin;
+    }
+    else {
+        data.window_h = _pixels_h;
+    }
+    _window_origin = data.origin;
+    _window_h = data.window_h;
     data.margin_v = _margin_v;
     data.margin_h = _margin_h;
+    // Publish a new snapshot only if text or layout changed
+    if (!_snapshot) {
+        _updateSnapshot();
+    }
+    data.snapshot = _snapshot;
+    _drawn_slot = _snapshot_slot;
+    // Keep pages used by this draw from being trimmed first
+    _snapshot->touchPages();
     data.draw_cursor = _edit_display_cursor;
     _getCursorPhysicalPos(data.cursor_x, data.cursor_y);
     data.cursor_h = _internal::Line::which(_lines, _edit_cursor)->fullsize;
@@ -1442,10 +2218,11 @@ void Area::_drawIfNeeded()
         data.selected.last = _locked_cursor > _edit_cursor ? _locked_cursor : _edit_cursor;
         data.selected.state = true;
     }
-    data.buffer_infos = *_buffer_infos;
-    data.lines = _lines;
+    // Determine damaged regions, and retrieve those of the processing pixels
+    _damageDrawState(data);
+    data.damage = (*_processing_pixels)->takeDamage();
     // Async draw
-    (*_processing_pixels)->run(data);
+    (*_processing_pixels)->run(data, isFocused() ? INT_MAX : _draw_priority);
     _draw = false;
 }
 
@@ -1,9 +1,13 @@
 #include "Text-Rendering/Format.hpp"
+#include <mutex>
+#include <unordered_map>
 
 SSS_TR_BEGIN;
 
 SSS_TR_API Format default_fmt{};
 
+std::atomic<FormatId::_Entry*> FormatId::_chunks[FormatId::_chunk_count]{};
+
 bool Color::operator==(Color const& color) const
 {
     if (func != color.func)
@@ -22,4 +26,124 @@ Format::Format() noexcept
         init = true;
 };
 
-SSS_TR_END;
\ No newline at end of file
+// Combines given hash with the hash of given value
+template<typename T>
+static void hashCombine(size_t& seed, T const& value)
+{
+    seed ^= std::hash<T>{}(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+}
+
+// Hashes given color, consistently with Color::operator==
+static void hashColor(size_t& seed, Color const& color)
+{
+    hashCombine(seed, static_cast<int>(color.func));
+    if (color.func == ColorFunc::None)
+        hashCombine(seed, color.rgb);
+}
+
+// Hashes all fields compared by Format::operator==
+static size_t hashFormat(Format const& fmt)
+{
+    size_t seed = 0;
+    hashCombine(seed, fmt.font);
+    hashCombine(seed, fmt.charsize);
+    hashCombine(seed, fmt.has_outline);
+    hashCombine(seed, fmt.outline_size);
+    hashCombine(seed, fmt.has_shadow);
+    hashCombine(seed, fmt.shadow_offset_x);
+    hashCombine(seed, fmt.shadow_offset_y);
+    hashCombine(seed, fmt.line_spacing);
+    hashCombine(seed, static_cast<int>(fmt.alignment));
+    hashCombine(seed, static_cast<int>(fmt.effect));
+    hashCombine(seed, fmt.effect_offset);
+    hashCombine(seed, fmt.effect_speed);
+    hashColor(seed, fmt.text_color);
+    hashColor(seed, fmt.outline_color);
+    hashColor(seed, fmt.shadow_color);
+    hashCombine(seed, fmt.alpha);
+    hashColor(seed, fmt.clear_color);
+    hashCombine(seed, fmt.lng_tag);
+    hashCombine(seed, fmt.lng_script);
+    hashCombine(seed, fmt.lng_direction);
+    hashCombine(seed, fmt.word_dividers);
+    hashCombine(seed, fmt.tw_short_pauses);
+    hashCombine(seed, fmt.tw_long_pauses);
+    return seed;
+}
+
+FormatId::FormatId() : FormatId(Format())
+{
+}
+
+// Interned format ids by format hash, and freed ids to reuse first.
+// Never destroyed, as static handles may outlive it.
+struct FormatRegistry {
+    std::mutex mutex;
+    std::unordered_multimap<size_t, uint32_t> ids;
+    std::vector<uint32_t> free_ids;
+    uint32_t count{ 0 };    // Number of ids ever used
+};
+static FormatRegistry& getFormatRegistry()
+{
+    static FormatRegistry* registry = new FormatRegistry();
+    return *registry;
+}
+
+FormatId::FormatId(Format const& fmt)
+{
+    FormatRegistry& registry = getFormatRegistry();
+    size_t const hash = hashFormat(fmt);
+    std::lock_guard<std::mutex> const lock(registry.mutex);
+    auto const [first, last] = registry.ids.equal_range(hash);
+    for (auto it = first; it != last; ++it) {
+        _id = it->second;
+        if (**this == fmt) {
+            _entry().refs.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+    // Intern a copy of the format, reusing a freed id or allocating a new chunk if needed
+    if (!registry.free_ids.empty()) {
+        _id = registry.free_ids.back();
+        registry.free_ids.pop_back();
+    }
+    else if (registry.count == _chunk_count << _chunk_bits) {
+        throw_exc("Too many distinct formats are referenced (2^20).");
+    }
+    else {
+        _id = registry.count++;
+    }
+    _Entry* chunk = _chunks[_id >> _chunk_bits].load(std::memory_order_relaxed);
+    if (!chunk) {
+        chunk = new _Entry[_chunk_mask + 1];
+    }
+    chunk[_id & _chunk_mask].fmt = fmt;
+    chunk[_id & _chunk_mask].refs.store(1, std::memory_order_relaxed);
+    chunk[_id & _chunk_mask].interned = true;
+    // Publish the chunk once the format is written (readers only get this id afterwards)
+    _chunks[_id >> _chunk_bits].store(chunk, std::memory_order_release);
+    registry.ids.emplace(hash, _id);
+}
+
+void FormatId::_free(uint32_t id) noexcept
+{
+    FormatRegistry& registry = getFormatRegistry();
+    std::lock_guard<std::mutex> const lock(registry.mutex);
+    _Entry& entry = _chunks[id >> _chunk_bits].load(std::memory_order_relaxed)[id & _chunk_mask];
+    // Interning may have found it again before the lock, and it may have
+    // been freed by that new handle already
+    if (entry.refs.load(std::memory_order_acquire) != 0 || !entry.interned) {
+        return;
+    }
+    auto const [first, last] = registry.ids.equal_range(hashFormat(entry.fmt));
+    for (auto it = first; it != last; ++it) {
+        if (it->second == id) {
+            registry.ids.erase(it);
+            break;
+        }
+    }
+    entry.interned = false;
+    registry.free_ids.push_back(id);
+}
+
+SSS_TR_END;
@@ -1,18 +1,23 @@
 #include "AreaInternals.hpp"
+#include "Blit.hpp"
+#include "RenderPool.hpp"
+#include <climits>
 
 SSS_TR_BEGIN;
 INTERNAL_BEGIN;
 
 Line::cit Line::which(vector const& lines, size_t cursor) noexcept
 {
-    Line::cit line = lines.cbegin();
-    while (line != lines.cend() - 1) {
-        if (line->last_glyph >= cursor) {
-            break;
-        }
-        ++line;
-    }
-    return line;
+    // First line ending at or after cursor, or the last one
+    return std::partition_point(lines.cbegin(), lines.cend() - 1,
+        [cursor](Line const& line) { return line.last_glyph < cursor; });
+}
+
+Line::cit Line::atHeight(vector const& lines, int y) noexcept
+{
+    // First line ending below y, or the last one
+    return std::partition_point(lines.cbegin(), lines.cend() - 1,
+        [y](Line const& line) { return line.scrolling <= y; });
 }
 
 int Line::x_offset(bool is_ltr) const noexcept
@@ -32,57 +37,426 @@ int Line::x_offset(bool is_ltr) const noexcept
 void Line::replace_pen(FT_Vector& pen, BufferInfoVector const& buffer_infos, size_t cursor) const noexcept
 {
     bool const area_is_ltr = buffer_infos.isLTR();
-    bool const is_ltr = buffer_infos.getBuffer(cursor).fmt.lng_direction == "ltr";
+    bool const is_ltr = buffer_infos.getBuffer(cursor).isLTR();
     if (area_is_ltr != is_ltr) {
-        for (size_t i = cursor; i != last_glyph; ++i) {
-            if ((buffer_infos.getBuffer(i).fmt.lng_direction == buffer_infos.getDirection()))
+        for (auto it = buffer_infos.getGlyphIterator(cursor); it.cursor() != last_glyph && it.valid(); ++it) {
+            if (it.buffer().properties.direction == buffer_infos.getDirection())
                 break;
-            pen.x += buffer_infos.getGlyph(i).pos.x_advance * (area_is_ltr ? 1 : -1);
+            pen.x += it.glyph().pos.x_advance * (area_is_ltr ? 1 : -1);
         }
     }
     else {
         for (size_t i = cursor - 1; i != first_glyph - 1; --i) {
-            if ((buffer_infos.getBuffer(i).fmt.lng_direction == buffer_infos.getDirection()))
+            if (buffer_infos.getBuffer(i).properties.direction == buffer_infos.getDirection())
                 break;
             pen.x += buffer_infos.getGlyph(i).pos.x_advance * (area_is_ltr ? 1 : -1);
         }
     }
 }
 
+void AreaSnapshot::invalidate(size_t first_line, size_t first_run) noexcept
+{
+    _valid_lines = std::min(_valid_lines, first_line);
+    _valid_runs = std::min(_valid_runs, first_run);
+}
+
+void AreaSnapshot::update(BufferInfoVector const& infos, Line::vector const& area_lines,
+    int w, int margin_v, int margin_h)
+{
+    // Alignments & pens depend on the layout
+    if (w != _w || margin_v != _margin_v || margin_h != _margin_h) {
+        _w = w;
+        _margin_v = margin_v;
+        _margin_h = margin_h;
+        _valid_lines = 0;
+    }
+    size_t const first_run = std::min({ _valid_runs, buffer_infos.size(), infos.size(), pages.size() });
+    size_t const first_line = std::min({ _valid_lines, lines.size(), area_lines.size() });
+    // Everything is updated again if this throws
+    _valid_runs = 0;
+    _valid_lines = 0;
+
+    // Copy modified runs, listing their pages.
+    // All pages are listed again once bitmaps were reloaded.
+    size_t const first_pages = _generation == Lib::getGeneration() ? first_run : 0;
+    _removePages(first_pages);
+    buffer_infos.assign(infos, first_run);
+    _listPages();
+    // Copy modified lines, then position their glyphs. The last glyph
+    // of a line depends on the next one, so the walk resumes a line before.
+    lines.resize(first_line);
+    lines.insert(lines.cend(), area_lines.cbegin() + static_cast<ptrdiff_t>(first_line), area_lines.cend());
+    _position(first_line > 0 ? first_line - 1 : 0);
+
+    _valid_runs = buffer_infos.size();
+    _valid_lines = lines.size();
+}
+
+void AreaSnapshot::touchPages() const
+{
+    for (auto const& [key, group] : page_groups) {
+        Lib::touchGlyphPages(key.first, key.second, group.pages);
+    }
+}
+
+void AreaSnapshot::_removePages(size_t first_run)
+{
+    for (size_t i = first_run; i < pages.size(); ++i) {
+        if (pages[i].empty())
+            continue;
+        Format const& fmt = buffer_infos[i].fmt;
+        auto const group = page_groups.find({ fmt.font, fmt.charsize });
+        if (group == page_groups.end())
+            continue;
+        std::map<uint32_t, size_t>& counts = group->second.counts;
+        for (uint32_t page : pages[i]) {
+            auto const count = counts.find(page);
+            if (count != counts.end() && --count->second == 0)
+                counts.erase(count);
+        }
+    }
+    pages.resize(std::min(first_run, pages.size()));
+}
+
+void AreaSnapshot::_listPages()
+{
+    size_t const generation = Lib::getGeneration();
+    _generation = generation;
+    for (size_t i = pages.size(); i < buffer_infos.size(); ++i) {
+        BufferInfo const& info = buffer_infos[i];
+        std::vector<uint32_t>& run_pages = pages.emplace_back();
+        // Pointers of older generations are dangling
+        if (info.generation != generation)
+            continue;
+        for (GlyphInfo const& glyph : info.glyphs) {
+            if (glyph.bitmap && glyph.bitmap->buffer)
+                run_pages.push_back(glyph.bitmap->page);
+            if (glyph.outline && glyph.outline->buffer)
+                run_pages.push_back(glyph.outline->page);
+        }
+        std::sort(run_pages.begin(), run_pages.end());
+        run_pages.erase(std::unique(run_pages.begin(), run_pages.end()), run_pages.end());
+        if (run_pages.empty())
+            continue;
+        Format const& fmt = info.fmt;
+        std::map<uint32_t, size_t>& counts = page_groups[{ fmt.font, fmt.charsize }].counts;
+        for (uint32_t page : run_pages) {
+            ++counts[page];
+        }
+    }
+    // Groups list their pages here, as touchPages() runs on every frame
+    for (auto it = page_groups.begin(); it != page_groups.end(); ) {
+        PageGroup& group = it->second;
+        if (group.counts.empty()) {
+            it = page_groups.erase(it);
+            continue;
+        }
+        group.pages.clear();
+        for (auto const& count : group.counts) {
+            group.pages.push_back(count.first);
+        }
+        ++it;
+    }
+}
+
+void AreaSnapshot::_position(size_t first_line)
+{
+    BufferInfoVector const& infos = buffer_infos;
+    size_t const glyph_count = infos.glyphCount();
+    bool const area_is_ltr = infos.isLTR();
+    // Resume from the last line reached by the previous walk, if before
+    first_line = std::min({ first_line, lines.size() - 1, _line_starts.empty() ? 0 : _line_starts.size() - 1 });
+    if (first_line == 0) {
+        _line_starts.clear();
+        Line const& line = lines.front();
+        int const x_offset = _margin_v + line.x_offset(area_is_ltr);
+        _LineStart& start = _line_starts.emplace_back();
+        start.pen.x = (area_is_ltr ? x_offset : _w - x_offset) << 6;
+        start.pen.y = -((_margin_h + line.y_offset) << 6);
+        start.is_ltr = area_is_ltr;
+        glyphs.clear();
+    }
+    else {
+        _line_starts.resize(first_line + 1);
+    }
+    _LineStart const start = _line_starts.back();
+    glyphs.resize(std::min(start.cursor, glyphs.size()));
+
+    bool is_ltr = start.is_ltr;
+    Line::cit line = lines.cbegin() + static_cast<ptrdiff_t>(first_line);
+    FT_Vector pen = start.pen;
+    size_t effect_cursor = start.effect_cursor;
+    BufferInfoVector::GlyphIterator glyph_it = infos.getGlyphIterator(start.cursor);
+    for (size_t cursor = start.cursor; cursor < glyph_count; ++cursor, ++glyph_it) {
+        GlyphInfo const& glyph_info(glyph_it.glyph());
+        BufferInfo const& buffer_info(glyph_it.buffer());
+        // Re-position the pen if direction changed
+        if (buffer_info.isLTR() != is_ltr) {
+            line->replace_pen(pen, infos, cursor);
+            is_ltr = !is_ltr;
+        }
+        auto const move_cursor = [&]() {
+            // Handle line breaks
+            if (cursor == line->last_glyph && line != lines.cend() - 1) {
+                pen.x = (area_is_ltr ? _margin_v : (_w - _margin_v)) << 6;
+                pen.y -= (line->fullsize - line->y_offset) << 6;
+                ++line;
+                pen.x += (line->x_offset(area_is_ltr) << 6) * (area_is_ltr ? 1 : -1);
+                pen.y -= line->y_offset << 6;
+                ++effect_cursor;
+                if (buffer_info.properties.direction != infos.getDirection()) {
+                    line->replace_pen(pen, infos, cursor + 1);
+                }
+                _line_starts.push_back({ pen, cursor + 1, effect_cursor, is_ltr });
+            }
+            // Increment pen's coordinates
+            else {
+                if (glyph_info.pos.x_advance != 0) {
+                    ++effect_cursor;
+                }
+                pen.x += glyph_info.pos.x_advance * (is_ltr ? 1 : -1);
+                pen.y += glyph_info.pos.y_advance;
+            }
+        };
+        PositionedGlyph& glyph = glyphs.emplace_back();
+        glyph.bg_pen = pen;
+        glyph.bg_line = static_cast<uint32_t>(line - lines.cbegin());
+        glyph.is_ltr = is_ltr;
+        // RTL glyphs are drawn left of the pen
+        if (!is_ltr)
+            move_cursor();
+        glyph.pen = pen;
+        glyph.charsize = line->charsize;
+        glyph.effect_cursor = effect_cursor;
+        if (is_ltr)
+            move_cursor();
+    }
+}
+
+Rect& Rect::operator|=(Rect const& rect) noexcept
+{
+    if (rect.empty())
+        return *this;
+    if (empty()) {
+        *this = rect;
+        return *this;
+    }
+    x0 = std::min(x0, rect.x0);
+    y0 = std::min(y0, rect.y0);
+    x1 = std::max(x1, rect.x1);
+    y1 = std::max(y1, rect.y1);
+    return *this;
+}
+
+Rect Rect::operator&(Rect const& rect) const noexcept
+{
+    Rect ret;
+    ret.x0 = std::max(x0, rect.x0);
+    ret.y0 = std::max(y0, rect.y0);
+    ret.x1 = std::min(x1, rect.x1);
+    ret.y1 = std::min(y1, rect.y1);
+    return ret;
+}
+
+void Damage::add(Rect const& r) noexcept
+{
+    if (!full)
+        rect |= r;
+}
+
+void Damage::scrollUp(int rows) noexcept
+{
+    if (full || rect.empty())
+        return;
+    // Unbounded edges stay so
+    if (rect.y0 != INT_MIN && rect.y0 != INT_MAX)
+        rect.y0 -= rows;
+    if (rect.y1 != INT_MIN && rect.y1 != INT_MAX)
+        rect.y1 -= rows;
+}
+
+AreaPixels::AreaPixels()
+    : _ticket(std::make_shared<_Ticket>())
+{
+    _ticket->pixels = this;
+}
+
+AreaPixels::~AreaPixels() noexcept
+{
+    cancel();
+}
+
+void AreaPixels::run(AreaData data, int priority)
+{
+    // Drawn rows are moved by the draw, from this origin
+    _origin -= _pending_scroll;
+    _pending_scroll = 0;
+    _data = std::move(data);
+    // Damage of dropped draws was never redrawn
+    if (_ticket->dropped.exchange(false)) {
+        _data.damage.full = true;
+    }
+    _ticket->canceled = false;
+    _ticket->state = _State::Queued;
+    RenderPool::submit([ticket = _ticket]() { _execute(ticket); }, priority,
+        [ticket = _ticket]() { _drop(ticket); });
+}
+
+void AreaPixels::cancel() noexcept
+{
+    _ticket->canceled = true;
+    // Queued jobs are dropped, running ones are waited for
+    _State queued = _State::Queued;
+    if (_ticket->state.compare_exchange_strong(queued, _State::Idle)) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(_ticket->mutex);
+    _ticket->done.wait(lock, [this]() { return _ticket->state != _State::Running; });
+}
+
+bool AreaPixels::collect() noexcept
+{
+    _State done = _State::Done;
+    if (!_ticket->state.compare_exchange_strong(done, _State::Idle))
+        return false;
+    _origin -= _pending_scroll;
+    _pending_scroll = 0;
+    return true;
+}
+
+void AreaPixels::scrollUp(int rows) noexcept
+{
+    _pending_damage.scrollUp(rows);
+    // Running draws set the origin once done
+    _State const state = _ticket->state;
+    if (state == _State::Idle || state == _State::Done)
+        _origin -= rows;
+    else
+        _pending_scroll += rows;
+}
+
+void AreaPixels::_execute(std::shared_ptr<_Ticket> const& ticket)
+{
+    // Skip if canceled, or if already run by a previous job of this ticket
+    _State queued = _State::Queued;
+    if (!ticket->state.compare_exchange_strong(queued, _State::Running)) {
+        return;
+    }
+    ticket->pixels->_draw();
+    {
+        std::lock_guard<std::mutex> const lock(ticket->mutex);
+        ticket->state = ticket->canceled ? _State::Idle : _State::Done;
+    }
+    ticket->done.notify_all();
+}
+
+void AreaPixels::_drop(std::shared_ptr<_Ticket> const& ticket) noexcept
+{
+    _State queued = _State::Queued;
+    if (ticket->state.compare_exchange_strong(queued, _State::Idle)) {
+        ticket->dropped = true;
+    }
+}
+
+void AreaPixels::_draw() try
+{
+    _asyncFunction(std::move(_data));
+}
+CATCH_AND_LOG_METHOD_EXC;
+
+Damage AreaPixels::takeDamage() noexcept
+{
+    Damage damage = _pending_damage;
+    _pending_damage.full = false;
+    _pending_damage.rect = Rect();
+    return damage;
+}
+
+bool AreaPixels::_shiftWindow(int origin, int window_h, Damage& damage)
+{
+    int const keep_first = std::max(_origin, origin);
+    int const keep_last = std::min(_origin + _window_h, origin + window_h);
+    if (keep_first >= keep_last) {
+        return false;
+    }
+    if (origin == _origin && window_h == _window_h) {
+        return true;
+    }
+    // Grow before moving rows, shrink after
+    size_t const w = static_cast<size_t>(_w);
+    if (window_h > _window_h) {
+        _pixels.resize(w * window_h);
+    }
+    auto const src = _pixels.begin() + (keep_first - _origin) * w;
+    auto const src_end = src + (keep_last - keep_first) * w;
+    auto const dst = _pixels.begin() + (keep_first - origin) * w;
+    if (dst < src) {
+        std::copy(src, src_end, dst);
+    }
+    else if (dst > src) {
+        std::copy_backward(src, src_end, dst + (src_end - src));
+    }
+    if (window_h < _window_h) {
+        _pixels.resize(w * window_h);
+    }
+    // Newly exposed rows need to be drawn
+    if (origin < keep_first) {
+        damage.add(Rect{ 0, origin, _w, keep_first });
+    }
+    if (keep_last < origin + window_h) {
+        damage.add(Rect{ 0, keep_last, _w, origin + window_h });
+    }
+    _origin = origin;
+    _window_h = window_h;
+    return true;
+}
+
 void AreaPixels::_asyncFunction(AreaData data)
 {
+    // Redraw everything if the width changed or the last draw was canceled,
+    // else keep rows which are still part of the rasterized window
+    bool const full = data.damage.full || !_complete || _w != data.w
+        || !_shiftWindow(data.origin, data.window_h, data.damage);
+    _complete = false;
+    BufferInfoVector const& buffer_infos = data.snapshot->buffer_infos;
     // Copy given data
     _w = data.w;
     _h = data.h;
     _pixels_h = data.pixels_h;
+    _origin = data.origin;
+    _window_h = data.window_h;
     // Resize if needed
-    _pixels.resize(_w * _pixels_h);
+    _pixels.resize(static_cast<size_t>(_w) * _window_h);
+    // Determine the region to redraw
+    _clip = Rect{ 0, _origin, _w, _origin + _window_h };
+    if (!full) {
+        _clip = _clip & data.damage.rect;
+        if (_clip.empty()) {
+            _complete = true;
+            return;
+        }
+    }
     // Clear
-    std::fill(_pixels.begin(), _pixels.end(), RGBA32(0, 0, 0, 0));
+    for (int y = _clip.y0; y < _clip.y1; ++y) {
+        RGBA32* row = _row(y);
+        std::fill(row + _clip.x0, row + _clip.x1, RGBA32(0, 0, 0, 0));
+    }
+    // Determine how far glyphs can be drawn past their line, to skip
+    // lines which don't intersect the redrawn region
+    _overflow = buffer_infos.getOverflow();
     // Reset time
     _time = std::chrono::duration_cast<std::chrono::milliseconds>(
         std::chrono::system_clock::now().time_since_epoch());
     // Generate RNG if needed
-    for (auto const& buffer : data.buffer_infos) {
-        if (buffer.fmt.effect == Effect::Vibrate) {
-            _rng.resize(data.buffer_infos.glyphCount());
-            for (FT_Vector& vec : _rng) {
-                vec.x = std::rand();
-                vec.y = std::rand();
-            }
-            break;
+    if (buffer_infos.getFlags() & RUN_VIBRATING) {
+        _rng.resize(buffer_infos.glyphCount());
+        for (FT_Vector& vec : _rng) {
+            vec.x = std::rand();
+            vec.y = std::rand();
         }
     }
 
     DrawParameters param;
-    {
-        Line const& line = data.lines.front();
-        if (data.buffer_infos.isLTR())
-            param.pen.x = (data.margin_v + line.x_offset(data.buffer_infos.isLTR())) << 6;
-        else
-            param.pen.x = (_w - data.margin_v - line.x_offset(data.buffer_infos.isLTR())) << 6;
-        param.pen.y = -(data.margin_h << 6);
-    }
     // Draw selected text's background
     if (data.selected.state) {
         param.is_selected_bg = true;
@@ -111,91 +485,71 @@ void AreaPixels::_asyncFunction(AreaData data)
     param.is_outline = false;
     _drawGlyphs(data, param);
 
+    if (_beingCanceled()) return;
+
     // Draw cursor
     if (data.draw_cursor) {
         for (int y = data.cursor_y - data.cursor_h; y < data.cursor_y; ++y) {
             for (int x = data.cursor_x; x < data.cursor_x + 2; ++x) {
-                size_t const i = x + y * _w;
-                if (x < data.w && i < _pixels.size()) {
-                    _pixels[i] = 0xFFFFFFFF;
-                }
+                if (x < _clip.x0 || y < _clip.y0 || x >= _clip.x1 || y >= _clip.y1)
+                    continue;
+                _row(y)[x] = 0xFFFFFFFF;
             }
         }
     }
+    _complete = true;
 }
 
 void AreaPixels::_drawGlyphs(AreaData const& data, DrawParameters param)
 {
-    // Draw the glyphs
-    Line::cit line = data.lines.cbegin();
-    param.charsize = line->charsize;
-    param.pen.y -= line->y_offset << 6;
-    bool const area_is_ltr = data.buffer_infos.isLTR();
-    bool is_ltr = data.buffer_infos.isLTR();
-    for (size_t cursor = 0; cursor < data.last_glyph; ++cursor) {
+    AreaSnapshot const& snapshot = *data.snapshot;
+    Line::vector const& lines = snapshot.lines;
+    BufferInfoVector const& buffer_infos = snapshot.buffer_infos;
+    // Skip lines ending above the redrawn region
+    Line::cit line = Line::atHeight(lines, _clip.y0 - data.margin_h - _overflow);
+    size_t const first_glyph = line->first_glyph;
+    size_t const last_glyph = std::min(data.last_glyph, snapshot.glyphs.size());
+    BufferInfoVector::GlyphIterator glyph_it = buffer_infos.getGlyphIterator(first_glyph);
+    for (size_t cursor = first_glyph; cursor < last_glyph; ++cursor, ++glyph_it) {
         if (_beingCanceled()) return;
-        GlyphInfo const& glyph_info(data.buffer_infos.getGlyph(cursor));
-        BufferInfo const& buffer_info(data.buffer_infos.getBuffer(cursor));
-        // Re-position the pen if direction changed
-        if ((buffer_info.fmt.lng_direction == "ltr") != is_ltr) {
-            line->replace_pen(param.pen, data.buffer_infos, cursor);
-            is_ltr = !is_ltr;
+        // Stop at the first line starting below the redrawn region
+        if (cursor > line->last_glyph && line != lines.cend() - 1) {
+            ++line;
+            if (data.margin_h + line->scrolling - line->fullsize - _overflow >= _clip.y1)
+                return;
         }
-        auto const move_cursor = [&]() {
-            // Handle line breaks. Return true if pen goes out of bound
-            if (cursor == line->last_glyph && line != data.lines.end() - 1) {
-                param.pen.x = (area_is_ltr ? data.margin_v : (_w - data.margin_v)) << 6;
-                param.pen.y -= (line->fullsize - line->y_offset) << 6;
-                ++line;
-                param.pen.x += (line->x_offset(area_is_ltr) << 6) * (area_is_ltr ? 1 : -1);
-                param.pen.y -= line->y_offset << 6;
-                param.charsize = line->charsize;
-                ++param.effect_cursor;
-                if (buffer_info.fmt.lng_direction != data.buffer_infos.getDirection()) {
-                    line->replace_pen(param.pen, data.buffer_infos, cursor+1);
-                }
-            }
-            // Increment pen's coordinates
-            else {
-                if (glyph_info.pos.x_advance != 0) {
-                    ++param.effect_cursor;
-                }
-                param.pen.x += glyph_info.pos.x_advance * (is_ltr ? 1 : -1);
-                param.pen.y += glyph_info.pos.y_advance;
-            }
-        };
+        GlyphInfo const& glyph_info(glyph_it.glyph());
+        BufferInfo const& buffer_info(glyph_it.buffer());
+        PositionedGlyph const& glyph(snapshot.glyphs[cursor]);
         if (param.is_selected_bg) {
-            // Cancel y offset
-            param.pen.y += line->y_offset << 6;
             if (cursor >= data.selected.first && cursor < data.selected.last) {
-                int x = (is_ltr ? param.pen.x : param.pen.x - glyph_info.pos.x_advance) >> 6;
-                int const x_max = (is_ltr ? param.pen.x + glyph_info.pos.x_advance : param.pen.x) >> 6,
-                          y_max = -(param.pen.y >> 6) + line->fullsize;
+                Line const& bg_line = lines[glyph.bg_line];
+                // Cancel y offset
+                FT_Pos const pen_x = glyph.bg_pen.x;
+                FT_Pos const pen_y = glyph.bg_pen.y + (bg_line.y_offset << 6);
+                int x = (glyph.is_ltr ? pen_x : pen_x - glyph_info.pos.x_advance) >> 6;
+                int const x_max = (glyph.is_ltr ? pen_x + glyph_info.pos.x_advance : pen_x) >> 6,
+                          y_max = -(pen_y >> 6) + bg_line.fullsize;
                 for ( ; x < x_max; ++x) {
-                    for (int y = -(param.pen.y >> 6); y < y_max; ++y) {
-                        if (x < 0 || y < 0 || x >= _w || y >= _pixels_h)
+                    for (int y = -(pen_y >> 6); y < y_max; ++y) {
+                        if (x < _clip.x0 || y < _clip.y0 || x >= _clip.x1 || y >= _clip.y1)
                             continue;
-                        _pixels[(size_t)(x + y * _w)] = RGB24(0, 0, 128);
+                        _row(y)[x] = RGB24(0, 0, 128);
                     }
                 }
             }
-            param.pen.y -= line->y_offset << 6;
-            move_cursor();
         }
-        else {
-            if (!is_ltr)
-                move_cursor();
-            if (!glyph_info.is_new_line) {
-                try {
-                    _drawGlyph(param, buffer_info, glyph_info);
-                }
-                catch (std::exception const& e) {
-                    std::string str(toString("cursor #") + toString(cursor));
-                    throw_exc(CONTEXT_MSG(str, e.what()));
-                }
+        else if (!glyph_info.is_new_line) {
+            param.pen = glyph.pen;
+            param.charsize = glyph.charsize;
+            param.effect_cursor = glyph.effect_cursor;
+            try {
+                _drawGlyph(param, buffer_info, glyph_info);
+            }
+            catch (std::exception const& e) {
+                std::string str(toString("cursor #") + toString(cursor));
+                throw_exc(CONTEXT_MSG(str, e.what()));
             }
-            if (is_ltr)
-                move_cursor();
         }
     }
 }
@@ -203,19 +557,24 @@ void AreaPixels::_drawGlyphs(AreaData const& data, DrawParameters param)
 void AreaPixels::_drawGlyph(DrawParameters const& param, BufferInfo const& buffer_info, GlyphInfo const& glyph_info)
 {
     // Skip if the glyph alpha is zero, or if a outline is asked but not available
-    if (buffer_info.fmt.alpha == 0
-        || (param.is_outline && (!buffer_info.fmt.has_outline || buffer_info.fmt.outline_size <= 0))
-        || (param.is_shadow && !buffer_info.fmt.has_shadow)) {
+    if (buffer_info.fmt->alpha == 0
+        || (param.is_outline && (!buffer_info.fmt->has_outline || buffer_info.fmt->outline_size <= 0))
+        || (param.is_shadow && !buffer_info.fmt->has_shadow)) {
         return;
     }
 
-    // Retrieve Font (must be loaded)
-    Font& font = Lib::getFont(buffer_info.fmt.font);
-
-    // Get corresponding loaded glyph bitmap
-    Bitmap const& bitmap(!param.is_outline
-        ? font.getGlyphBitmap(glyph_info.info.codepoint, buffer_info.fmt.charsize)
-        : font.getOutlineBitmap(glyph_info.info.codepoint, buffer_info.fmt.charsize, buffer_info.fmt.outline_size));
+    // Get corresponding loaded glyph bitmap, resolved when shaping
+    Bitmap const* resolved = param.is_outline ? glyph_info.outline : glyph_info.bitmap;
+    if (!resolved || buffer_info.generation != Lib::getGeneration()) {
+        // Retrieve Font (must be loaded), and reload the glyph if it was evicted
+        Font& font = Lib::getFont(buffer_info.fmt->font);
+        font.loadGlyph(glyph_info.info.codepoint, buffer_info.fmt->charsize,
+            buffer_info.fmt->has_outline ? buffer_info.fmt->outline_size : 0);
+        resolved = !param.is_outline
+            ? &font.getGlyphBitmap(glyph_info.info.codepoint, buffer_info.fmt->charsize)
+            : &font.getOutlineBitmap(glyph_info.info.codepoint, buffer_info.fmt->charsize, buffer_info.fmt->outline_size);
+    }
+    Bitmap const& bitmap(*resolved);
     // Skip if bitmap is empty
     if (bitmap.width == 0 || bitmap.height == 0) {
         return;
@@ -233,21 +592,21 @@ void AreaPixels::_drawGlyph(DrawParameters const& param, BufferInfo const& buffe
 
     // Retrieve the color to use
     if (param.is_shadow) {
-        args.color = buffer_info.fmt.shadow_color;
+        args.color = buffer_info.fmt->shadow_color;
     }
     else if (param.is_outline) {
-        args.color = buffer_info.fmt.outline_color;
+        args.color = buffer_info.fmt->outline_color;
     }
     else [[likely]] {
-        args.color = buffer_info.fmt.text_color;
+        args.color = buffer_info.fmt->text_color;
     }
-    args.alpha = buffer_info.fmt.alpha;
+    args.alpha = buffer_info.fmt->alpha;
 
     if (!param.is_shadow && !param.is_outline && !param.is_selected_bg) {
         RGB24 clear_color;
-        switch (buffer_info.fmt.clear_color.func) {
+        switch (buffer_info.fmt->clear_color.func) {
         case ColorFunc::None:
-            clear_color = buffer_info.fmt.clear_color;
+            clear_color = buffer_info.fmt->clear_color;
             break;
         case ColorFunc::Rainbow:
             clear_color = rainbow((_time.count() / 10 - (args.x0 + bitmap.width / 2) - (args.y0 + bitmap.height / 2) * 2) % _w, _w);
@@ -256,55 +615,55 @@ void AreaPixels::_drawGlyph(DrawParameters const& param, BufferInfo const& buffe
             clear_color = rainbow((args.x0 + args.y0 * 2) % _w, _w);
             break;
         }
-        for (FT_Int i = 0; i < bitmap.width; ++i) {
-            for (FT_Int j = 0; j < bitmap.height; ++j) {
-                int const x = args.x0 + i;
-                int const y = args.y0 + j;
-                if (x < 0 || y < 0 || x >= _w || y >= _pixels_h)
-                    continue;
-                RGBA32& pixel = _pixels[(size_t)(x + y * _w)];
-                pixel *= RGBA32(clear_color, buffer_info.fmt.alpha);
+        // Clip once, then walk rows
+        int const x_first = std::max(args.x0, _clip.x0), x_last = std::min(args.x0 + bitmap.width, _clip.x1);
+        int const y_first = std::max(args.y0, _clip.y0), y_last = std::min(args.y0 + bitmap.height, _clip.y1);
+        RGBA32 const clear_pixel(clear_color, buffer_info.fmt->alpha);
+        for (int y = y_first; y < y_last; ++y) {
+            RGBA32* row = _row(y);
+            for (int x = x_first; x < x_last; ++x) {
+                row[x] *= clear_pixel;
             }
         }
     }
 
-    switch (buffer_info.fmt.effect) {
+    switch (buffer_info.fmt->effect) {
     case Effect::None:
         break;
     case Effect::Waves:
     case Effect::FadingWaves: 
     {
-        if (buffer_info.fmt.effect_offset == 0) break;
+        if (buffer_info.fmt->effect_offset == 0) break;
 
         // 2PI
         static const float pi2 = std::acosf(-1.f) * 2.f;
         // Use effect_speed for timing/sign and effect_offset as a pixel offset
-        int const n = 2 + std::labs(buffer_info.fmt.effect_speed);
-        int const sign = buffer_info.fmt.effect_speed > 0 ? 1 : -1;
+        int const n = 2 + std::labs(buffer_info.fmt->effect_speed);
+        int const sign = buffer_info.fmt->effect_speed > 0 ? 1 : -1;
         // Pen value in real coordinates
         int const x = pen.x >> 6;
         // Time offset (speed control)
         long long const t = _time.count() / 25;
         // Fading factor (1.f when simple waves)
         float fade = 1.f;
-        if (buffer_info.fmt.effect == Effect::FadingWaves)
+        if (buffer_info.fmt->effect == Effect::FadingWaves)
             fade += static_cast<float>(sign > 0 ? _w - x : x) / static_cast<float>(_w / 2);
         // Pen & fade based x value
         int const x_faded = static_cast<int>(fade * static_cast<float>(x * sign) / 10.f);
         // Final factor based on time, fading, x coordinates and sign
         float const factor = static_cast<float>((t - x_faded) % n) / static_cast<float>(n);
         // Size factor: use effect_offset as amplitude (in pixels). If zero, fallback to previous formula.
-        float const size = buffer_info.fmt.effect_offset != 0
-            ? static_cast<float>(std::abs(buffer_info.fmt.effect_offset))
-            : static_cast<float>(buffer_info.fmt.charsize) / 3.f;
+        float const size = buffer_info.fmt->effect_offset != 0
+            ? static_cast<float>(std::abs(buffer_info.fmt->effect_offset))
+            : static_cast<float>(buffer_info.fmt->charsize) / 3.f;
         // Compute and add actual offset
         args.y0 += static_cast<int>(std::sinf(pi2 * factor) * size);
     }   break;
     case Effect::Vibrate: 
     {
-        if (buffer_info.fmt.effect_offset == 0) break;
+        if (buffer_info.fmt->effect_offset == 0) break;
 
-        int const n = buffer_info.fmt.effect_offset;
+        int const n = buffer_info.fmt->effect_offset;
         if (n == 0) break;
         args.x0 += (n-1) - (_rng.at(param.effect_cursor).x % (n * 2));
         args.y0 += (n-1) - (_rng.at(param.effect_cursor).y % (n * 2));
@@ -312,8 +671,8 @@ void AreaPixels::_drawGlyph(DrawParameters const& param, BufferInfo const& buffe
     }
 
     if (param.is_shadow) {
-        args.x0 += buffer_info.fmt.shadow_offset_x;
-        args.y0 += buffer_info.fmt.shadow_offset_y;
+        args.x0 += buffer_info.fmt->shadow_offset_x;
+        args.y0 += buffer_info.fmt->shadow_offset_y;
     }
 
     _copyBitmap(args);
@@ -321,54 +680,61 @@ void AreaPixels::_drawGlyph(DrawParameters const& param, BufferInfo const& buffe
 
 void AreaPixels::_copyBitmap(_CopyBitmapArgs& args)
 {
-    // Go through each pixel
-    for (FT_Int i = 0, x = args.x0; i < args.bitmap.width; x++, i += args.bitmap.bpp) {
-        for (FT_Int j = 0, y = args.y0; j < args.bitmap.height; y++, j++) {
-
-            // Skip if coordinates are out the pixel array's bounds
-            if (x < 0 || y < 0 || x >= _w || y >= _pixels_h)
-                continue;
-
-            // Retrieve buffer index and corresponding pixel reference
-            size_t const buf_index = (size_t)(j * args.bitmap.width + i);
-            RGBA32& pixel = _pixels[(size_t)(x + y * _w)];
-
-            // Copy pixel
-            switch (args.bitmap.pixel_mode) {
-                // In this case, bitmaps have 1 byte per pixel.
-                // Hence, they are monochrome (gray).
-            case FT_PIXEL_MODE_GRAY: {
-                // Skip if the glyph's pixel value is 0
-                uint8_t const px_value = args.bitmap.buffer[buf_index];
+    Bitmap const& bitmap = args.bitmap;
+    // Bitmaps are expected to have 1 byte per pixel.
+    // Hence, they are monochrome (gray).
+    if (bitmap.pixel_mode != FT_PIXEL_MODE_GRAY) {
+        LOG_METHOD_ERR("Unkown bitmap pixel mode.");
+        return;
+    }
+
+    // Clip once per glyph, rather than for each pixel.
+    // Glyphs outside of the redrawn region are skipped.
+    int const i_first = std::max(0, _clip.x0 - args.x0);
+    int const i_last = std::min(bitmap.width, _clip.x1 - args.x0);
+    int const j_first = std::max(0, _clip.y0 - args.y0);
+    int const j_last = std::min(bitmap.height, _clip.y1 - args.y0);
+    if (i_first >= i_last || j_first >= j_last) {
+        return;
+    }
+
+    // Walk rows contiguously, skipping spans of empty coverage
+    auto const blend = [&](auto const& get_color) {
+        for (int j = j_first; j < j_last; ++j) {
+            int const y = args.y0 + j;
+            uint8_t const* src = bitmap.buffer + static_cast<size_t>(j) * bitmap.pitch;
+            RGBA32* dst = _row(y) + (args.x0 + i_first);
+            size_t i = findCoverage(src, i_first, i_last);
+            while (i < static_cast<size_t>(i_last)) {
+                uint8_t const px_value = src[i];
                 if (px_value == 0) {
+                    i = findCoverage(src, i + 1, i_last);
                     continue;
                 }
-                // Determine color
-                RGB24 color;
-                switch (args.color.func) {
-                case ColorFunc::None:
-                    color = args.color;
-                    break;
-                case ColorFunc::Rainbow:
-                    color = rainbow((_time.count() / 10 - x - y * 2) % _w, _w);
-                    break;
-                case ColorFunc::RainbowFixed:
-                    color = rainbow((x + y * 2) % _w, _w);
-                    break;
-                }
+                int const x = args.x0 + static_cast<int>(i);
                 // Blend with existing pixel, using the glyph's pixel value as an alpha
-                pixel *= RGBA32(color, px_value);
-                // Lower alpha post blending if needed
-                if (pixel.a > args.alpha) {
-                    pixel.a = args.alpha;
-                }
-                break;
-            }
-            default:
-                LOG_METHOD_ERR("Unkown bitmap pixel mode.");
-                return;
+                blendPixel(dst[i - i_first], get_color(x, y), px_value, args.alpha);
+                ++i;
             }
         }
+    };
+
+    // Determine color function once per glyph
+    switch (args.color.func) {
+    case ColorFunc::None: {
+        RGB24 const color = args.color;
+        blend([&color](int, int) { return color; });
+    }   break;
+    case ColorFunc::Rainbow: {
+        long long const t = _time.count() / 10;
+        blend([this, t](int x, int y) { return rainbow((t - x - y * 2) % _w, _w); });
+    }   break;
+    case ColorFunc::RainbowFixed:
+        blend([this](int x, int y) { return rainbow((x + y * 2) % _w, _w); });
+        break;
+    default:
+        blend([](int, int) { return RGB24(); });
+        break;
     }
 }
 
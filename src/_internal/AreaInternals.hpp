@@ -2,6 +2,9 @@
 #define SSS_TR_AREAINTERNALS_HPP
 
 #include "Buffer.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <map>
 
 /** @file
  *  Defines internal asynchronous drawing classes.
@@ -19,21 +22,53 @@ struct Line {
     int fullsize{ 0 };       // Line's full size, in pixels
     int y_offset{ 0 };       // Line's y offset (half of fullsize - charsize)
     int charsize{ 0 };       // The highest charsize on the line
-    int scrolling{ 0 };      // Total scrolling for this line to be above the top
+    int scrolling{ 0 };      // Total scrolling for this line to be above the top,
+                             // i.e. sum of fullsizes up to this line (included)
     int used_width{ 0 };     // Line's used vertical width, in pixels
     int unused_width{ 0 };   // Line's unused vertical width, in pixels
+    int max_used_width{ 0 }; // Highest used_width up to this line (included)
     Alignment alignment{ Alignment::Left }; // Text alignment
     // Aliases
     using vector = std::vector<Line>;
     using it = vector::iterator;
     using cit = vector::const_iterator;
     
+    // Returns the line holding given glyph, in O(log n)
     static cit which(vector const& lines, size_t cursor) noexcept;
+    // Returns the line at given height (margin excluded), in O(log n)
+    static cit atHeight(vector const& lines, int y) noexcept;
     int x_offset(bool is_ltr) const noexcept;
     // Function to replace pen when text direction changes on a line
     void replace_pen(FT_Vector& pen, BufferInfoVector const& buffer_infos, size_t cursor) const noexcept;
 };
 
+// Rectangle in pixel coordinates, x1 & y1 being excluded
+struct Rect {
+    int x0{ 0 };
+    int y0{ 0 };
+    int x1{ 0 };
+    int y1{ 0 };
+
+    inline bool empty() const noexcept { return x0 >= x1 || y0 >= y1; };
+    inline bool intersects(int x_0, int y_0, int x_1, int y_1) const noexcept {
+        return x_0 < x1 && x_1 > x0 && y_0 < y1 && y_1 > y0;
+    };
+    // Bounding box of both rectangles
+    Rect& operator|=(Rect const& rect) noexcept;
+    // Intersection of both rectangles
+    Rect operator&(Rect const& rect) const noexcept;
+};
+
+// Regions of the pixels which need to be redrawn
+struct Damage {
+    bool full{ true };  // Whether everything needs to be redrawn
+    Rect rect;          // Bounding box of damaged regions, if not full
+
+    void add(Rect const& rect) noexcept;
+    // Moves the damaged region up by given rows
+    void scrollUp(int rows) noexcept;
+};
+
 // Draw parameters
 struct DrawParameters {
     FT_Vector pen{ 0, 0 }; // Pen on the canvas
@@ -46,11 +81,75 @@ struct DrawParameters {
     bool is_outline{ true };    // Draw glyphs or their outlines
 };
 
+// A glyph positioned by the pen walk, shared by all draw passes
+struct PositionedGlyph {
+    FT_Vector pen{ 0, 0 };      // Pen used to draw the glyph
+    FT_Vector bg_pen{ 0, 0 };   // Pen before advancing past the glyph
+    int charsize{ 0 };          // Charsize of the line the glyph is drawn on
+    uint32_t bg_line{ 0 };      // Index of the line holding bg_pen
+    size_t effect_cursor{ 0 };  // Index grouping glyphs for effects
+    bool is_ltr{ true };        // Direction the pen moves in
+};
+
+// Immutable text & layout state shared between the Area and its async draws.
+// The Area updates two of them in turns, so that the one of the running draw
+// is left as is, each update copying & positioning only what was modified.
+struct AreaSnapshot {
+    BufferInfoVector buffer_infos; // Glyph infos
+    Line::vector lines;     // Line vector
+    std::vector<PositionedGlyph> glyphs; // Display list, one per glyph
+    // Atlas pages used by each run, in buffer_infos order
+    std::vector<std::vector<uint32_t>> pages;
+    // Atlas pages used by the runs of a font & charsize, with their run count
+    struct PageGroup {
+        std::map<uint32_t, size_t> counts;
+        std::vector<uint32_t> pages;
+    };
+    std::map<std::pair<std::string, int>, PageGroup> page_groups;
+
+    // Marks lines & runs from given ones as modified
+    void invalidate(size_t first_line, size_t first_run) noexcept;
+    // Copies lines & runs modified since the last update, then walks
+    // the pen from the line before the first modified one.
+    // No draw may use this snapshot meanwhile.
+    void update(BufferInfoVector const& infos, Line::vector const& area_lines,
+        int w, int margin_v, int margin_h);
+    // Marks listed pages as used by the current frame
+    void touchPages() const;
+
+private:
+    // Pen state when reaching the first glyph of a line
+    struct _LineStart {
+        FT_Vector pen{ 0, 0 };
+        size_t cursor{ 0 };
+        size_t effect_cursor{ 0 };
+        bool is_ltr{ true };
+    };
+    std::vector<_LineStart> _line_starts; // One per line reached by the pen
+    size_t _valid_lines{ 0 };   // Lines unmodified since the last update
+    size_t _valid_runs{ 0 };    // Runs unmodified since the last update
+    size_t _generation{ 0 };    // Lib::getGeneration() when pages were listed
+    // Layout glyphs were positioned with
+    int _w{ 0 };
+    int _margin_v{ 0 };
+    int _margin_h{ 0 };
+
+    // Walks the pen from given line, filling the display list
+    void _position(size_t first_line);
+    // Removes pages of runs from given one from their groups
+    void _removePages(size_t first_run);
+    // Lists atlas pages of runs not listed yet whose bitmaps are resolved
+    void _listPages();
+};
+
+// Per-frame draw state
 struct AreaData {
     // Area size
     int w{ 0 }; // Width of the Area
     int h{ 0 }; // Height of the Area
     int pixels_h{ 0 }; // Real height of the Area
+    int origin{ 0 };   // First row of the Area to be rasterized
+    int window_h{ 0 }; // Number of rows to be rasterized, from origin
     int margin_v{ 0 }; // Vertical margin of the Area, in pixels
     int margin_h{ 0 }; // Horizontal margin of the Area, in pixels
     // Cursor's physical position & height
@@ -65,23 +164,74 @@ struct AreaData {
         size_t last{ 0 };
         bool state{ false };
     } selected;
-    Line::vector lines;     // Line vector
-    BufferInfoVector buffer_infos; // Glyph infos
+    std::shared_ptr<AreaSnapshot const> snapshot; // Text & layout
+    Damage damage;          // Regions to redraw
 };
 
-class AreaPixels : public SSS::Async<AreaData> {
+// Pixels drawn asynchronously, on the shared RenderPool
+class AreaPixels {
 public:
+    AreaPixels();
+    // Cancels any queued or running draw
+    ~AreaPixels() noexcept;
+
+    // Queues a draw of given data, higher priorities being drawn first
+    void run(AreaData data, int priority);
+    // Cancels the queued or running draw, waiting for it to stop
+    void cancel() noexcept;
+    // Whether a draw is queued, running, or finished but not collected yet
+    inline bool isRunning() const noexcept { return _ticket->state != _State::Idle; };
+    // Main thread only : returns true once per finished draw
+    bool collect() noexcept;
+
     inline RGBA32::Vector const& getPixels() const noexcept { return _pixels; };
     inline void getDimensions(int& w, int& h) const noexcept { w = _w; h = _h; };
+    // Rasterized rows, in Area coordinates : [origin, origin + window_h)
+    inline void getWindow(int& origin, int& window_h) const noexcept { origin = _origin; window_h = _window_h; };
     inline auto sizeDiff(AreaPixels const& a) const noexcept { return _w != a._w || _h != a._h; };
 
+    // Main thread only : accumulates damage until the next draw of these pixels
+    inline void addDamage(Rect const& rect) noexcept { _pending_damage.add(rect); };
+    inline void addDamage() noexcept { _pending_damage.full = true; };
+    Damage takeDamage() noexcept;
+    // Main thread only : moves drawn rows & damage up by given rows, once
+    // text above them was removed. Applied when the running draw ends, if any.
+    void scrollUp(int rows) noexcept;
+
 private:
-    virtual void _asyncFunction(AreaData param);
+    enum class _State { Idle, Queued, Running, Done };
+    // Shared with queued jobs, which may outlive these pixels
+    struct _Ticket {
+        AreaPixels* pixels{ nullptr };
+        std::atomic<_State> state{ _State::Idle };
+        std::atomic<bool> canceled{ false };
+        std::atomic<bool> dropped{ false }; // Set when the pool dropped the queued job
+        std::mutex mutex;
+        std::condition_variable done; // Notified when leaving _State::Running
+    };
+    std::shared_ptr<_Ticket> _ticket;
+    AreaData _data; // Data of the queued draw
+
+    // Runs the queued draw, unless it was canceled
+    static void _execute(std::shared_ptr<_Ticket> const& ticket);
+    // Lets the queued draw be run again, once the pool dropped its job
+    static void _drop(std::shared_ptr<_Ticket> const& ticket) noexcept;
+    // Runs _asyncFunction() on the queued data, logging errors
+    void _draw();
+    inline bool _beingCanceled() const noexcept { return _ticket->canceled; };
+    void _asyncFunction(AreaData param);
 
     int _w{ 0 };
     int _h{ 0 };
     int _pixels_h{ 0 };
-    RGBA32::Vector _pixels;
+    int _origin{ 0 };
+    int _window_h{ 0 };
+    RGBA32::Vector _pixels; // Rasterized window, of _w * _window_h
+    int _overflow{ 0 };     // Max pixels glyphs can be drawn past their line
+    Damage _pending_damage; // Damage since the last draw, main thread only
+    int _pending_scroll{ 0 }; // Rows to scroll up once the running draw ends, main thread only
+    Rect _clip;             // Region being redrawn
+    bool _complete{ false };// Whether the last draw wasn't canceled
     std::chrono::milliseconds _time;
     std::vector<FT_Vector> _rng; // Used for effects (grouped vibrations)
 
@@ -98,6 +248,10 @@ private:
         uint8_t alpha{ 0 }; // Bitmap's opacity
     };
 
+    // Returns the row of _pixels matching given Area row
+    inline RGBA32* _row(int y) noexcept { return _pixels.data() + static_cast<size_t>(y - _origin) * _w; };
+    // Moves rows kept from the previous window, returns false if none were
+    bool _shiftWindow(int origin, int window_h, Damage& damage);
     void _drawGlyphs(AreaData const& data, DrawParameters param);
     void _drawGlyph(DrawParameters const& param, BufferInfo const& buffer_info, GlyphInfo const& glyph_info);
     void _copyBitmap(_CopyBitmapArgs& args);
@@ -0,0 +1,97 @@
+#include "Blit.hpp"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+# define SSS_TR_X86
+# include <immintrin.h>
+# ifdef _MSC_VER
+#  include <intrin.h>
+#  define SSS_TR_TARGET_AVX2
+# else
+#  include <cpuid.h>
+#  define SSS_TR_TARGET_AVX2 __attribute__((target("avx2")))
+# endif
+#endif
+
+SSS_TR_BEGIN;
+INTERNAL_BEGIN;
+
+static size_t _findCoverageScalar(uint8_t const* coverage, size_t first, size_t last) noexcept
+{
+    while (first < last && coverage[first] == 0) {
+        ++first;
+    }
+    return first;
+}
+
+#ifdef SSS_TR_X86
+
+static size_t _findCoverageSSE2(uint8_t const* coverage, size_t first, size_t last) noexcept
+{
+    __m128i const zero = _mm_setzero_si128();
+    for (; first + 16 <= last; first += 16) {
+        __m128i const chunk = _mm_loadu_si128(reinterpret_cast<__m128i const*>(coverage + first));
+        int const mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, zero));
+        if (mask != 0xFFFF)
+            break;
+    }
+    return _findCoverageScalar(coverage, first, last);
+}
+
+SSS_TR_TARGET_AVX2
+static size_t _findCoverageAVX2(uint8_t const* coverage, size_t first, size_t last) noexcept
+{
+    __m256i const zero = _mm256_setzero_si256();
+    for (; first + 32 <= last; first += 32) {
+        __m256i const chunk = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(coverage + first));
+        unsigned int const mask = static_cast<unsigned int>(
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, zero)));
+        if (mask != 0xFFFFFFFFu)
+            break;
+    }
+    return _findCoverageSSE2(coverage, first, last);
+}
+
+static bool _hasAVX2() noexcept
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    // OSXSAVE & AVX, then check that the OS saves YMM registers
+    if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+        return false;
+    if ((_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // SSS_TR_X86
+
+using _FindCoverageFunc = size_t(*)(uint8_t const*, size_t, size_t) noexcept;
+
+// Runtime dispatch, resolved once
+static _FindCoverageFunc _resolveFindCoverage() noexcept
+{
+#ifdef SSS_TR_X86
+    if (_hasAVX2())
+        return &_findCoverageAVX2;
+    return &_findCoverageSSE2;
+#else
+    return &_findCoverageScalar;
+#endif
+}
+
+size_t findCoverage(uint8_t const* coverage, size_t first, size_t last) noexcept
+{
+    static _FindCoverageFunc const func = _resolveFindCoverage();
+    return func(coverage, first, last);
+}
+
+INTERNAL_END;
+SSS_TR_END;
@@ -0,0 +1,32 @@
+#ifndef SSS_TR_BLIT_HPP
+#define SSS_TR_BLIT_HPP
+
+#include "Text-Rendering/_includes.hpp"
+
+/** @file
+ *  Defines internal helpers used when blitting glyph bitmaps.
+ */
+
+SSS_TR_BEGIN;
+INTERNAL_BEGIN;
+
+// Returns the index of the first non-zero coverage byte in [first, last),
+// or last if there is none. Uses AVX2 or SSE2 when available.
+size_t findCoverage(uint8_t const* coverage, size_t first, size_t last) noexcept;
+
+// Blends given color over given pixel, using the coverage as the color's
+// alpha, then lowers the resulting alpha to max_alpha if needed.
+// Pixels are left untouched where coverage is 0.
+inline void blendPixel(RGBA32& pixel, RGB24 const& color, uint8_t coverage, uint8_t max_alpha) noexcept
+{
+    if (coverage == 0)
+        return;
+    pixel *= RGBA32(color, coverage);
+    if (pixel.a > max_alpha)
+        pixel.a = max_alpha;
+}
+
+INTERNAL_END;
+SSS_TR_END;
+
+#endif // SSS_TR_BLIT_HPP
@@ -1,19 +1,52 @@
 #include "Buffer.hpp"
+#include "ShapeCache.hpp"
+#include <cctype>
 
 SSS_TR_BEGIN;
 INTERNAL_BEGIN;
 
+BufferInfoVector::GlyphIterator::GlyphIterator(BufferInfoVector const& buffer_infos, size_t cursor)
+    : _buffer_infos(&buffer_infos), _cursor(cursor)
+{
+    if (cursor >= buffer_infos._glyph_count) {
+        _buffer = buffer_infos.size();
+        return;
+    }
+    _buffer = buffer_infos.getBufferIndex(cursor);
+    _glyph = cursor - buffer_infos._offsets[_buffer];
+}
+
+BufferInfoVector::GlyphIterator& BufferInfoVector::GlyphIterator::operator++() noexcept
+{
+    ++_cursor;
+    ++_glyph;
+    // Skip to the next non-empty buffer if needed
+    while (_buffer < _buffer_infos->size()
+        && _glyph >= (*_buffer_infos)[_buffer].glyphs.size())
+    {
+        ++_buffer;
+        _glyph = 0;
+    }
+    return *this;
+}
+
+size_t BufferInfoVector::getBufferIndex(size_t cursor) const noexcept
+{
+    if (cursor >= _glyph_count)
+        return empty() ? 0 : size() - 1;
+    // Last buffer whose first glyph is <= cursor (skips empty buffers)
+    auto const it = std::upper_bound(_offsets.cbegin(), _offsets.cend(), cursor);
+    return static_cast<size_t>(it - _offsets.cbegin()) - 1;
+}
+
 GlyphInfo const& BufferInfoVector::getGlyph(size_t cursor) const try
 {
     if (_glyph_count == 0)
         throw_exc("Empty buffer");
-    for (BufferInfo const& buffer_info : *this) {
-        if (buffer_info.glyphs.size() > cursor) {
-            return buffer_info.glyphs.at(cursor);
-        }
-        cursor -= buffer_info.glyphs.size();
-    }
-    return back().glyphs.back();
+    if (cursor >= _glyph_count)
+        return back().glyphs.back();
+    size_t const index = getBufferIndex(cursor);
+    return at(index).glyphs.at(cursor - _offsets[index]);
 }
 CATCH_AND_RETHROW_METHOD_EXC;
 
@@ -21,15 +54,66 @@ _internal::BufferInfo const& BufferInfoVector::getBuffer(size_t cursor) const tr
 {
     if (empty())
         throw_exc("Empty buffer list");
-    for (BufferInfo const& buffer_info : *this) {
-        if (buffer_info.glyphs.size() > cursor) {
-            return buffer_info;
+    return at(getBufferIndex(cursor));
+}
+CATCH_AND_RETHROW_METHOD_EXC;
+
+// Whether both glyphs are laid out & drawn the same way
+static bool sameGlyph(GlyphInfo const& a, GlyphInfo const& b) noexcept
+{
+    return a.info.codepoint == b.info.codepoint
+        && a.pos.x_advance == b.pos.x_advance && a.pos.y_advance == b.pos.y_advance
+        && a.pos.x_offset == b.pos.x_offset && a.pos.y_offset == b.pos.y_offset
+        && a.is_new_line == b.is_new_line && a.is_word_divider == b.is_word_divider;
+}
+
+size_t BufferInfoVector::firstDifference(BufferInfoVector const& other, size_t from) const
+{
+    if (_direction != other._direction)
+        return 0;
+    from = std::min({ from, _glyph_count, other._glyph_count });
+    GlyphIterator a = getGlyphIterator(from), b = other.getGlyphIterator(from);
+    size_t a_buffer = size(), b_buffer = other.size();
+    for (; a.valid() && b.valid(); ++a, ++b) {
+        // Compare formats when entering a new buffer on either side
+        if (a.bufferIndex() != a_buffer || b.bufferIndex() != b_buffer) {
+            a_buffer = a.bufferIndex();
+            b_buffer = b.bufferIndex();
+            if (!(a.buffer().fmt == b.buffer().fmt))
+                return a.cursor();
         }
-        cursor -= buffer_info.glyphs.size();
+        if (!sameGlyph(a.glyph(), b.glyph()))
+            return a.cursor();
     }
-    return back();
+    if (a.valid() || b.valid())
+        return a.cursor();
+    return std::max(_glyph_count, other._glyph_count);
+}
+
+size_t BufferInfoVector::commonSuffix(BufferInfoVector const& other) const
+{
+    if (_direction != other._direction)
+        return 0;
+    size_t const max = std::min(_glyph_count, other._glyph_count);
+    size_t a_buffer = size(), b_buffer = other.size();
+    size_t a_glyph = 0, b_glyph = 0;
+    size_t count = 0;
+    for (; count < max; ++count) {
+        // Step back to the previous non-empty buffer on either side,
+        // and compare formats when doing so
+        bool new_buffer = false;
+        for (; a_glyph == 0; new_buffer = true)
+            a_glyph = (*this)[--a_buffer].glyphs.size();
+        for (; b_glyph == 0; new_buffer = true)
+            b_glyph = other[--b_buffer].glyphs.size();
+        BufferInfo const& a = (*this)[a_buffer], & b = other[b_buffer];
+        if (new_buffer && !(a.fmt == b.fmt))
+            break;
+        if (!sameGlyph(a.glyphs[--a_glyph], b.glyphs[--b_glyph]))
+            break;
+    }
+    return count;
 }
-CATCH_AND_RETHROW_METHOD_EXC;
 
 char32_t const& BufferInfoVector::getChar(size_t cursor) const try
 {
@@ -48,24 +132,71 @@ std::u32string BufferInfoVector::getString() const
     return str;
 }
 
-void BufferInfoVector::update(std::vector<Buffer::Ptr> const& buffers)
+void BufferInfoVector::update(std::vector<Buffer::Ptr> const& buffers, size_t first_buffer)
 {
-    _glyph_count = 0;
-    clear();
-    reserve(buffers.size());
-    for (Buffer::Ptr const& ptr : buffers) {
-        _internal::Buffer& buffer = *ptr;
-        emplace_back(buffer._info);
-        _glyph_count += buffer.glyphCount();
+    _truncate(std::min(first_buffer, buffers.size()));
+    if (empty()) {
+        _infos.reserve(buffers.size());
+        _offsets.reserve(buffers.size());
+        _totals.reserve(buffers.size());
+    }
+    for (auto it = buffers.cbegin() + size(); it != buffers.cend(); ++it) {
+        _push((*it)->getSharedInfo());
     }
     if (!empty())
-        _direction = front().fmt.lng_direction;
+        _direction = front().properties.direction;
+}
+
+void BufferInfoVector::assign(BufferInfoVector const& other, size_t first_buffer)
+{
+    _truncate(std::min(first_buffer, other.size()));
+    size_t const first = size();
+    _infos.insert(_infos.cend(), other._infos.cbegin() + first, other._infos.cend());
+    _offsets.insert(_offsets.cend(), other._offsets.cbegin() + first, other._offsets.cend());
+    _totals.insert(_totals.cend(), other._totals.cbegin() + first, other._totals.cend());
+    _glyph_count = other._glyph_count;
+    _direction = other._direction;
+}
+
+BufferInfoVector BufferInfoVector::tail(size_t first_buffer) const
+{
+    BufferInfoVector infos;
+    first_buffer = std::min(first_buffer, size());
+    infos._infos.assign(_infos.cbegin() + first_buffer, _infos.cend());
+    infos._offsets.assign(_offsets.cbegin() + first_buffer, _offsets.cend());
+    infos._totals.assign(_totals.cbegin() + first_buffer, _totals.cend());
+    infos._glyph_count = _glyph_count;
+    infos._direction = _direction;
+    return infos;
 }
 
 void BufferInfoVector::clear() noexcept
 {
     _glyph_count = 0;
-    vector::clear();
+    _offsets.clear();
+    _totals.clear();
+    _infos.clear();
+}
+
+void BufferInfoVector::_truncate(size_t size) noexcept
+{
+    if (size >= _infos.size())
+        return;
+    _glyph_count = _offsets[size];
+    _infos.resize(size);
+    _offsets.resize(size);
+    _totals.resize(size);
+}
+
+void BufferInfoVector::_push(Ptr const& info)
+{
+    _Totals totals = _totals.empty() ? _Totals() : _totals.back();
+    totals.flags |= info->flags;
+    totals.overflow = std::max(totals.overflow, info->overflow);
+    _infos.push_back(info);
+    _offsets.push_back(_glyph_count);
+    _totals.push_back(totals);
+    _glyph_count += info->glyphs.size();
 }
 
 
@@ -80,7 +211,9 @@ Buffer::Buffer(TextPart const& part) try
         throw_exc("HarfBuzz buffer allocation failed.");
     }
 
-    set(part);
+    // Resolve the format even if it's the default one
+    _info.str = part.str;
+    changeFormat(part.fmt);
 
     if (Log::TR::Buffers::query(Log::TR::Buffers::get().life_state)) {
         char buff[256];
@@ -104,8 +237,10 @@ Buffer::~Buffer()
 
 void Buffer::set(TextPart const& part)
 {
-    if (_info.fmt == part.fmt && _info.str == part.str)
+    if (_info.fmt == part.fmt) {
+        changeString(part.str);
         return;
+    }
     _info.fmt = part.fmt;
     _info.str = part.str;
 
@@ -115,17 +250,39 @@ void Buffer::set(TextPart const& part)
 
 void Buffer::changeString(std::u32string const& str)
 {
+    if (_info.str == str)
+        return;
+    // Find common prefix & suffix to only reshape what changed
+    size_t const old_size = _info.str.size();
+    size_t const min_size = std::min(old_size, str.size());
+    size_t prefix = 0;
+    while (prefix < min_size && _info.str[prefix] == str[prefix])
+        ++prefix;
+    size_t suffix = 0;
+    while (suffix < min_size - prefix
+        && _info.str[old_size - suffix - 1] == str[str.size() - suffix - 1])
+    {
+        ++suffix;
+    }
     _info.str = str;
-    _updateBuffer();
+    _updateBuffer(prefix, old_size - prefix - suffix, str.size() - prefix - suffix);
 }
 
-void Buffer::changeFormat(Format const& fmt)
+void Buffer::changeFormat(FormatId fmt)
 {
     _info.fmt = fmt;
     _formatChanged();
     _updateBuffer();
 }
 
+BufferInfoVector::Ptr const& Buffer::getSharedInfo()
+{
+    if (!_shared_info) {
+        _shared_info = std::make_shared<BufferInfo const>(_info);
+    }
+    return _shared_info;
+}
+
 uint32_t Buffer::getClusterIndex(size_t cursor) const
 {
     if (cursor >= glyphCount()) {
@@ -140,7 +297,7 @@ void Buffer::insertText(std::u32string const& str, size_t cursor)
 {
     uint32_t const index = getClusterIndex(cursor);
     _info.str.insert(_info.str.cbegin() + index, str.cbegin(), str.cend());
-    _updateBuffer();
+    _updateBuffer(index, 0, str.size());
 }
 
 void Buffer::insertText(std::string const& str, size_t cursor)
@@ -155,28 +312,64 @@ void Buffer::deleteText(size_t cursor, size_t count)
     size_t const first = getClusterIndex(cursor);
     size_t const last = first + count < _info.str.size() ? first + count : _info.str.size();
     _info.str.erase(_info.str.cbegin() + first, _info.str.cbegin() + last);
-    _updateBuffer();
+    _updateBuffer(first, last - first, 0);
+}
+
+// Returns given direction ("ltr", "rtl", "ttb" or "btt", case insensitive),
+// or the default one if it is none of those
+static hb_direction_t directionFromString(std::string const& str)
+{
+    std::string lower(str);
+    for (char& c : lower)
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    if (lower == "ltr" || lower == "rtl" || lower == "ttb" || lower == "btt")
+        return hb_direction_from_string(lower.c_str(), -1);
+    std::string const default_direction = Format().lng_direction;
+    char buff[256];
+    sprintf_s(buff, "Invalid text direction \"%.64s\", using \"%s\".",
+        str.c_str(), default_direction.c_str());
+    LOG_FUNC_WRN(buff);
+    return hb_direction_from_string(default_direction.c_str(), -1);
 }
 
 // Reshapes the buffer with given parameters
 void Buffer::_formatChanged() try
 {
+    _shared_info.reset();
     // Retrieve Font (must be loaded)
-    Font& font = Lib::getFont(_info.fmt.font);
-
-    for (char& c : _info.fmt.lng_direction)
-        c = std::tolower(c);
-
-    // Set buffer properties
-    _properties.direction = hb_direction_from_string(_info.fmt.lng_direction.c_str(), -1);
-    _properties.script = hb_script_from_string(_info.fmt.lng_script.c_str(), -1);
-    _properties.language = hb_language_from_string(_info.fmt.lng_tag.c_str(), -1);
-    _info.locale = std::locale(_info.fmt.lng_tag);
+    Font& font = Lib::getFont(_info.fmt->font);
+
+    // Set buffer properties (directions are case insensitive)
+    Format const& fmt = _info.fmt;
+    _info.properties.direction = directionFromString(fmt.lng_direction);
+    _info.properties.script = hb_script_from_string(fmt.lng_script.c_str(), -1);
+    _info.properties.language = hb_language_from_string(fmt.lng_tag.c_str(), -1);
+    _info.locale = std::locale(fmt.lng_tag);
+
+    // Set run flags, so that per-glyph paths don't read the format
+    _info.flags = 0;
+    if (_info.properties.direction == HB_DIRECTION_LTR)
+        _info.flags |= RUN_LTR;
+    if (fmt.effect == Effect::Vibrate)
+        _info.flags |= RUN_VIBRATING;
+    if ((fmt.effect != Effect::None && fmt.effect != Effect::Vibrate)
+        || fmt.text_color.func == ColorFunc::Rainbow
+        || (fmt.has_outline && fmt.outline_color.func == ColorFunc::Rainbow)
+        || (fmt.has_shadow && fmt.shadow_color.func == ColorFunc::Rainbow))
+    {
+        _info.flags |= RUN_ANIMATED;
+    }
+    // Glyphs may be drawn past their line by effects, outlines & shadows
+    _info.overflow = fmt.charsize + std::abs(fmt.effect_offset);
+    if (fmt.has_outline)
+        _info.overflow += fmt.outline_size;
+    if (fmt.has_shadow)
+        _info.overflow += std::max(std::abs(fmt.shadow_offset_x), std::abs(fmt.shadow_offset_y));
 
     // Convert word dividers to glyph indexes
     _wd_indexes.clear();
-    _wd_indexes.reserve(_info.fmt.word_dividers.size());
-    for (char32_t const& c : _info.fmt.word_dividers) {
+    _wd_indexes.reserve(_info.fmt->word_dividers.size());
+    for (char32_t const& c : _info.fmt->word_dividers) {
         FT_UInt const index(FT_Get_Char_Index(font.getFTFace(), c));
         _wd_indexes.push_back(index);
     }
@@ -185,26 +378,133 @@ CATCH_AND_RETHROW_METHOD_EXC;
 
 void Buffer::_updateBuffer()
 {
+    _shared_info.reset();
     _shape();
     _loadGlyphs();
 }
 
+void Buffer::_updateBuffer(size_t first, size_t removed, size_t inserted) try
+{
+    _shared_info.reset();
+    bool spliced = false;
+    try {
+        spliced = _spliceGlyphs(first, removed, inserted);
+    }
+    catch (...) {
+        // Glyphs may be half spliced, reshaping everything restores them.
+        // Errors thrown from there are propagated.
+    }
+    if (!spliced)
+        _updateBuffer();
+}
+CATCH_AND_RETHROW_METHOD_EXC;
+
+bool Buffer::_spliceGlyphs(size_t first, size_t removed, size_t inserted)
+{
+    std::vector<GlyphInfo>& glyphs = _info.glyphs;
+    // Nothing to splice into
+    if (glyphs.empty()) {
+        return false;
+    }
+    size_t const old_size = _info.str.size() + removed - inserted;
+
+    // Whether the text can't be broken right before given glyph
+    auto const unsafe_to_break = [&glyphs](size_t i) -> bool {
+        if (i == 0 || i >= glyphs.size())
+            return false;
+        return (hb_glyph_info_get_glyph_flags(&glyphs[i].info) & HB_GLYPH_FLAG_UNSAFE_TO_BREAK)
+            || glyphs[i].info.cluster == glyphs[i - 1].info.cluster;
+    };
+    // First glyph whose cluster is >= given character index
+    auto const find_glyph = [&glyphs](size_t index) -> size_t {
+        auto const it = std::lower_bound(glyphs.cbegin(), glyphs.cend(), index,
+            [](GlyphInfo const& glyph, size_t index) { return glyph.info.cluster < index; });
+        return static_cast<size_t>(it - glyphs.cbegin());
+    };
+
+    // Widen the edited range by one glyph of context on each side,
+    // then up to the nearest safe-to-break boundaries
+    size_t first_glyph = find_glyph(first);
+    if (first_glyph != 0)
+        --first_glyph;
+    while (unsafe_to_break(first_glyph))
+        --first_glyph;
+    size_t last_glyph = find_glyph(first + removed);
+    if (last_glyph < glyphs.size())
+        ++last_glyph;
+    while (unsafe_to_break(last_glyph))
+        ++last_glyph;
+
+    // Corresponding character range, in the new string
+    size_t const first_char = first_glyph == 0 ? 0 : glyphs[first_glyph].info.cluster;
+    size_t const last_char = (last_glyph == glyphs.size() ? old_size
+        : glyphs[last_glyph].info.cluster) + inserted - removed;
+
+    // The whole string is affected, no need to splice
+    if (first_char == 0 && last_char == _info.str.size()) {
+        return false;
+    }
+
+    std::vector<GlyphInfo> shaped;
+    _shapeRange(first_char, last_char, shaped);
+    // The new glyphs interact with the preceding ones, reshape everything
+    if (first_glyph != 0 && !shaped.empty() && (hb_glyph_info_get_glyph_flags(
+        &shaped.front().info) & HB_GLYPH_FLAG_UNSAFE_TO_BREAK))
+    {
+        return false;
+    }
+
+    // Shift clusters of following glyphs
+    for (size_t i = last_glyph; i < glyphs.size(); ++i) {
+        glyphs[i].info.cluster = static_cast<uint32_t>(glyphs[i].info.cluster + inserted - removed);
+    }
+    // Splice the new glyphs
+    glyphs.erase(glyphs.cbegin() + first_glyph, glyphs.cbegin() + last_glyph);
+    glyphs.insert(glyphs.cbegin() + first_glyph, shaped.cbegin(), shaped.cend());
+
+    _loadGlyphs(first_glyph, first_glyph + shaped.size());
+    return true;
+}
+
 // Shapes the buffer and retrieve its informations
 void Buffer::_shape() try
+{
+    _info.glyphs.clear();
+    // Short runs (labels, names, numbers) are looked up in the shared cache
+    if (_info.str.size() > ShapeCache::max_length) {
+        _shapeRange(0, _info.str.size(), _info.glyphs);
+        return;
+    }
+    ShapeCache::Key const key{ _info.fmt->font, _info.fmt->charsize, _info.properties.direction,
+        _info.properties.script, _info.properties.language, _info.str };
+    if (ShapeCache::get(key, _info.glyphs)) {
+        // Flags depend on this buffer's word dividers
+        for (GlyphInfo& glyph : _info.glyphs) {
+            _setGlyphFlags(glyph);
+        }
+        return;
+    }
+    _shapeRange(0, _info.str.size(), _info.glyphs);
+    ShapeCache::add(key, _info.glyphs);
+}
+CATCH_AND_LOG_METHOD_EXC;
+
+// Shapes given character range, using the rest of the string as context
+void Buffer::_shapeRange(size_t first, size_t last, std::vector<GlyphInfo>& glyphs)
 {
     // Retrieve Font (must be loaded)
-    Font& font = Lib::getFont(_info.fmt.font);
+    Font& font = Lib::getFont(_info.fmt->font);
 
-    font.setCharsize(_info.fmt.charsize);
-    // Add string to buffer
+    // Add string to buffer, the rest of the string is used as context
     uint32_t const* indexes = reinterpret_cast<uint32_t const*>(&_info.str[0]);
     int size = static_cast<int>(_info.str.size());
-    hb_buffer_add_utf32(_buffer.get(), indexes, size, 0U, size);
+    hb_buffer_add_utf32(_buffer.get(), indexes, size,
+        static_cast<unsigned int>(first), static_cast<int>(last - first));
     // Set properties
-    hb_buffer_set_segment_properties(_buffer.get(), &_properties);
+    hb_buffer_set_segment_properties(_buffer.get(), &_info.properties);
     hb_buffer_set_cluster_level(_buffer.get(), HB_BUFFER_CLUSTER_LEVEL_MONOTONE_CHARACTERS);
     // Shape buffer and retrieve informations
-    hb_shape(font.getHBFont(_info.fmt.charsize), _buffer.get(), nullptr, 0);
+    font.shape(_buffer.get(), _info.fmt->charsize);
 
     // Retrieve glyph informations
     unsigned int glyph_count = 0;
@@ -212,47 +512,84 @@ void Buffer::_shape() try
     // Retrieve glyph positions
     hb_glyph_position_t const* pos = hb_buffer_get_glyph_positions(_buffer.get(), nullptr);
 
-    _info.glyphs.clear();
-    _info.glyphs.resize(glyph_count);
+    glyphs.resize(glyph_count);
     for (size_t i = 0; i < glyph_count; ++i) {
         // Reverse if RTL
-        size_t const index = _info.fmt.lng_direction == "ltr" ? i : (glyph_count - (i + 1));
-        _internal::GlyphInfo& glyph = _info.glyphs.at(index);
+        size_t const index = _info.isLTR() ? i : (glyph_count - (i + 1));
+        _internal::GlyphInfo& glyph = glyphs.at(index);
         glyph.info = info[i];
         glyph.pos = pos[i];
-        // Check if the glyph is a word divider
-        for (hb_codepoint_t index : _wd_indexes) {
-            if (glyph.info.codepoint == index) {
-                glyph.is_word_divider = true;
-                break;
-            }
-        }
-        // Check if the glyph is a new line
-        if (_info.str.at(glyph.info.cluster) == '\n') {
-            glyph.is_new_line = true;
-            glyph.is_word_divider = true;
-        }
+        _setGlyphFlags(glyph);
     }
     // Now that we have all needed informations,
     // reset buffer to free HarfBuzz's internal cache
     // (this does NOT free the buffer itself, only its contents)
     hb_buffer_reset(_buffer.get());
 }
-CATCH_AND_LOG_METHOD_EXC;
+
+void Buffer::_setGlyphFlags(GlyphInfo& glyph) const
+{
+    glyph.is_word_divider = false;
+    glyph.is_new_line = false;
+    // Check if the glyph is a word divider
+    for (hb_codepoint_t index : _wd_indexes) {
+        if (glyph.info.codepoint == index) {
+            glyph.is_word_divider = true;
+            break;
+        }
+    }
+    // Check if the glyph is a new line
+    if (_info.str.at(glyph.info.cluster) == '\n') {
+        glyph.is_new_line = true;
+        glyph.is_word_divider = true;
+    }
+}
 
 void Buffer::_loadGlyphs()
 {
+    _loadGlyphs(0, _info.glyphs.size());
+}
+
+void Buffer::_loadGlyphs(size_t first, size_t last)
+{
+    _shared_info.reset();
     // Retrieve Font (must be loaded)
-    Font& font = Lib::getFont(_info.fmt.font);
+    Font& font = Lib::getFont(_info.fmt->font);
+
+    // Bitmaps of glyphs outside of the range may have been freed since
+    size_t const generation = Lib::getGeneration();
+    if (_info.generation != generation) {
+        first = 0;
+        last = _info.glyphs.size();
+        _info.generation = generation;
+    }
 
     // Load glyphs
-    int const outline_size = _info.fmt.has_outline ? _info.fmt.outline_size : 0;
-    std::unordered_set<hb_codepoint_t> glyph_ids;
-    for (_internal::GlyphInfo const& glyph : _info.glyphs) {
-        glyph_ids.insert(glyph.info.codepoint);
+    int const charsize = _info.fmt->charsize;
+    int const outline_size = _info.fmt->has_outline ? _info.fmt->outline_size : 0;
+    std::unordered_map<hb_codepoint_t, std::pair<Bitmap const*, Bitmap const*>> bitmaps;
+    for (size_t i = first; i < last; ++i) {
+        bitmaps.emplace(_info.glyphs[i].info.codepoint, std::make_pair(nullptr, nullptr));
+    }
+    // Rasterize missing glyphs in one batch (in parallel if there are many of them)
+    std::vector<FT_UInt> glyph_ids;
+    glyph_ids.reserve(bitmaps.size());
+    for (auto const& [glyph_id, bitmap] : bitmaps) {
+        glyph_ids.push_back(glyph_id);
+    }
+    font.loadGlyphs(glyph_ids, charsize, outline_size);
+    for (auto& [glyph_id, bitmap] : bitmaps) {
+        // Glyphs which failed to load keep null bitmaps
+        if (font.loadGlyph(glyph_id, charsize, outline_size))
+            continue;
+        bitmap.first = &font.getGlyphBitmap(glyph_id, charsize);
+        if (outline_size > 0)
+            bitmap.second = &font.getOutlineBitmap(glyph_id, charsize, outline_size);
     }
-    for (hb_codepoint_t const& glyph_id: glyph_ids) {
-        font.loadGlyph(glyph_id, _info.fmt.charsize, outline_size);
+    // Store resolved bitmaps, so draws don't look them up
+    for (size_t i = first; i < last; ++i) {
+        GlyphInfo& glyph = _info.glyphs[i];
+        std::tie(glyph.bitmap, glyph.outline) = bitmaps.at(glyph.info.codepoint);
     }
 }
 
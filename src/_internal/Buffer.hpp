@@ -33,28 +33,155 @@ struct GlyphInfo {
     hb_glyph_position_t pos{};      // The glyph's position
     bool is_word_divider{ false };  // Whether the glyph is a word divider OR a \n
     bool is_new_line{ false };      // Whether the glyph is a \n (new line)
+    // Loaded bitmaps, valid while BufferInfo::generation is current
+    Bitmap const* bitmap{ nullptr };    // The glyph's bitmap
+    Bitmap const* outline{ nullptr };   // Its outline's bitmap, if any
 };
 
 
+// Per-run flags, resolved from the format once it changes
+enum RunFlags : uint32_t {
+    RUN_LTR         = 1 << 0,   // Left to right direction
+    RUN_VIBRATING   = 1 << 1,   // Vibrate effect, redrawn at a fixed rate
+    RUN_ANIMATED    = 1 << 2,   // Other effects or drawn rainbow colors, redrawn every frame
+};
+
 struct BufferInfo : public TextPart {
     std::vector<GlyphInfo> glyphs;  // Glyph infos
     std::locale locale; // Locale
+    size_t generation{ 0 }; // Lib::getGeneration() when bitmaps were resolved
+    hb_segment_properties_t properties{};   // HB presets : lng, script, direction
+    uint32_t flags{ 0 };    // RunFlags
+    int overflow{ 0 };      // Max pixels glyphs can be drawn past their line
+
+    inline bool isLTR() const noexcept { return flags & RUN_LTR; };
 };
 
-class BufferInfoVector : public std::vector<BufferInfo> {
+// Immutable infos of all buffers. Infos are shared with the buffers which
+// published them, so that only modified buffers are copied on updates,
+// and updated from the first modified buffer.
+class BufferInfoVector {
 public:
+    using Ptr = std::shared_ptr<BufferInfo const>;
+
+    // Iterates infos as if they were stored by value
+    class const_iterator {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = BufferInfo;
+        using difference_type = std::ptrdiff_t;
+        using pointer = BufferInfo const*;
+        using reference = BufferInfo const&;
+
+        const_iterator() = default;
+        explicit const_iterator(std::vector<Ptr>::const_iterator it) noexcept : _it(it) {};
+
+        inline reference operator*() const noexcept { return **_it; };
+        inline pointer operator->() const noexcept { return _it->get(); };
+        inline reference operator[](difference_type n) const noexcept { return *_it[n]; };
+        inline const_iterator& operator++() noexcept { ++_it; return *this; };
+        inline const_iterator operator++(int) noexcept { return const_iterator(_it++); };
+        inline const_iterator& operator--() noexcept { --_it; return *this; };
+        inline const_iterator operator--(int) noexcept { return const_iterator(_it--); };
+        inline const_iterator& operator+=(difference_type n) noexcept { _it += n; return *this; };
+        inline const_iterator& operator-=(difference_type n) noexcept { _it -= n; return *this; };
+        inline const_iterator operator+(difference_type n) const noexcept { return const_iterator(_it + n); };
+        inline const_iterator operator-(difference_type n) const noexcept { return const_iterator(_it - n); };
+        inline difference_type operator-(const_iterator const& it) const noexcept { return _it - it._it; };
+        friend inline const_iterator operator+(difference_type n, const_iterator const& it) noexcept { return it + n; };
+        inline bool operator==(const_iterator const& it) const noexcept { return _it == it._it; };
+        inline bool operator!=(const_iterator const& it) const noexcept { return _it != it._it; };
+        inline bool operator<(const_iterator const& it) const noexcept { return _it < it._it; };
+        inline bool operator>(const_iterator const& it) const noexcept { return _it > it._it; };
+        inline bool operator<=(const_iterator const& it) const noexcept { return _it <= it._it; };
+        inline bool operator>=(const_iterator const& it) const noexcept { return _it >= it._it; };
+    private:
+        std::vector<Ptr>::const_iterator _it;
+    };
+    using iterator = const_iterator;
+
+    // Sequential glyph iterator, yielding (buffer, glyph) pairs in O(1) per step
+    class GlyphIterator {
+    public:
+        GlyphIterator(BufferInfoVector const& buffer_infos, size_t cursor);
+
+        inline size_t cursor() const noexcept { return _cursor; };
+        inline size_t bufferIndex() const noexcept { return _buffer; };
+        inline BufferInfo const& buffer() const noexcept { return (*_buffer_infos)[_buffer]; };
+        inline GlyphInfo const& glyph() const noexcept { return buffer().glyphs[_glyph]; };
+        // Whether the iterator points to an existing glyph
+        inline bool valid() const noexcept { return _cursor < _buffer_infos->_glyph_count; };
+
+        GlyphIterator& operator++() noexcept;
+    private:
+        BufferInfoVector const* _buffer_infos;
+        size_t _buffer{ 0 };    // Index of the current BufferInfo
+        size_t _glyph{ 0 };     // Index of the glyph in the current BufferInfo
+        size_t _cursor{ 0 };    // Global glyph index
+    };
+
+    inline size_t size() const noexcept { return _infos.size(); };
+    inline bool empty() const noexcept { return _infos.empty(); };
+    inline BufferInfo const& operator[](size_t index) const noexcept { return *_infos[index]; };
+    inline BufferInfo const& at(size_t index) const { return *_infos.at(index); };
+    inline BufferInfo const& front() const noexcept { return *_infos.front(); };
+    inline BufferInfo const& back() const noexcept { return *_infos.back(); };
+    inline const_iterator begin() const noexcept { return const_iterator(_infos.cbegin()); };
+    inline const_iterator end() const noexcept { return const_iterator(_infos.cend()); };
+    inline const_iterator cbegin() const noexcept { return begin(); };
+    inline const_iterator cend() const noexcept { return end(); };
+
     inline size_t glyphCount() const noexcept { return _glyph_count; };
-    inline std::string getDirection() const noexcept { return _direction; };
-    inline bool isLTR() const noexcept { return _direction == "ltr"; };
+    inline hb_direction_t getDirection() const noexcept { return _direction; };
+    inline bool isLTR() const noexcept { return _direction == HB_DIRECTION_LTR; };
+    // Union of the RunFlags of all buffers
+    inline uint32_t getFlags() const noexcept { return _totals.empty() ? 0 : _totals.back().flags; };
+    // Max pixels glyphs of any buffer can be drawn past their line
+    inline int getOverflow() const noexcept { return _totals.empty() ? 0 : _totals.back().overflow; };
     GlyphInfo const& getGlyph(size_t cursor) const;
     BufferInfo const& getBuffer(size_t cursor) const;
     char32_t const& getChar(size_t cursor) const;
+    // Returns the index of the BufferInfo holding given glyph, in O(log n)
+    size_t getBufferIndex(size_t cursor) const noexcept;
+    // Returns the index of the first glyph of given BufferInfo
+    inline size_t getFirstGlyph(size_t buffer_index) const noexcept { return _offsets[buffer_index]; };
+    // Returns the index of the first glyph which is drawn differently
+    // in given vector, or the highest glyph count if none.
+    // Glyphs before given one are known to be the same.
+    // Either vector may be a tail() holding given glyph.
+    size_t firstDifference(BufferInfoVector const& other, size_t from = 0) const;
+    // Returns the number of trailing glyphs drawn the same way in both vectors
+    size_t commonSuffix(BufferInfoVector const& other) const;
+    // Returns an iterator starting at given glyph
+    inline GlyphIterator getGlyphIterator(size_t cursor = 0) const { return GlyphIterator(*this, cursor); };
     std::u32string getString() const;
-    void update(std::vector<std::unique_ptr<Buffer>> const& buffers);
+    // Shares the infos of given buffers from given one, copying only those
+    // modified since. Previous buffers are known to be unmodified.
+    void update(std::vector<std::unique_ptr<Buffer>> const& buffers, size_t first_buffer = 0);
+    // Shares the infos of given vector from given buffer, keeping previous ones
+    void assign(BufferInfoVector const& other, size_t first_buffer);
+    // Returns the infos from given buffer, keeping their glyph indexes.
+    // Only glyphs from the first one of given buffer can be accessed.
+    BufferInfoVector tail(size_t first_buffer) const;
     void clear() noexcept;
 private:
+    // Prefix totals of buffer properties, known in O(1) for all buffers
+    struct _Totals {
+        uint32_t flags{ 0 };    // Union of RunFlags
+        int overflow{ 0 };      // Max BufferInfo::overflow
+    };
+
+    std::vector<Ptr> _infos;
     size_t _glyph_count{ 0 };
-    std::string _direction;
+    hb_direction_t _direction{ HB_DIRECTION_INVALID };
+    // Prefix sums of glyph counts : index of the first glyph of each BufferInfo
+    std::vector<size_t> _offsets;
+    std::vector<_Totals> _totals;
+
+    // Resizes all vectors to given buffer count, updating the glyph count
+    void _truncate(size_t size) noexcept;
+    // Appends given infos, along with their offset & totals
+    void _push(Ptr const& info);
 };
 
     // --- Main class ---
@@ -75,7 +202,7 @@ public:
 
     void set(TextPart const& part);
     void changeString(std::u32string const& str);
-    void changeFormat(Format const& fmt);
+    void changeFormat(FormatId fmt);
 
     uint32_t getClusterIndex(size_t cursor) const;
 
@@ -88,26 +215,42 @@ public:
     inline size_t glyphCount() const noexcept { return _info.glyphs.size(); };
 
     inline std::u32string const& getString() const noexcept { return _info.str; };
-    inline Format const& getFormat() const noexcept { return _info.fmt; };
+    inline Format const& getFormat() const noexcept { return *_info.fmt; };
+    inline FormatId getFormatId() const noexcept { return _info.fmt; };
 
     inline BufferInfo const& getInfo() const noexcept { return _info; };
+    // Returns an immutable copy of the infos, made once per modification
+    BufferInfoVector::Ptr const& getSharedInfo();
 
 private:
 
     HB_Buffer_Ptr _buffer;  // HarfBuzz buffer
     BufferInfo _info;       // Buffer informations
+    BufferInfoVector::Ptr _shared_info; // Copy of _info, reset when it changes
 
-    hb_segment_properties_t _properties;    // HB presets : lng, script, direction
     std::vector<uint32_t> _wd_indexes;      // Word dividers as glyph indexes
 
-    // Modifies internal options
+    // Resolves format options : HB presets, run flags, word dividers
     void _formatChanged();
 
     void _updateBuffer();
+    // Reshapes only the text surrounding an edit of the string, widened to
+    // safe-to-break boundaries, and splices the result in the glyph vector.
+    // Falls back to a full _updateBuffer() when the splice isn't safe or fails.
+    void _updateBuffer(size_t first, size_t removed, size_t inserted);
+    // Splices the edit in the glyph vector, returns false if it isn't safe
+    bool _spliceGlyphs(size_t first, size_t removed, size_t inserted);
     // Shapes the buffer and retrieve its informations
     void _shape();
+    // Shapes given character range, using the rest of the string as context.
+    // Resulting glyphs are in logical order, with absolute clusters.
+    void _shapeRange(size_t first, size_t last, std::vector<GlyphInfo>& glyphs);
+    // Sets word divider & new line flags of given glyph
+    void _setGlyphFlags(GlyphInfo& glyph) const;
     // Loads needed glyphs
     void _loadGlyphs();
+    // Loads needed glyphs of given glyph range
+    void _loadGlyphs(size_t first, size_t last);
 };
 
 INTERNAL_END;
@@ -1,8 +1,46 @@
 #include "Font.hpp"
+#include "RenderPool.hpp"
+#include <climits>
 
 SSS_TR_BEGIN;
 INTERNAL_BEGIN;
 
+// Creates a face reading given mapped file, which it keeps alive
+static FT_Face newMemoryFace(FT_Library library, std::shared_ptr<MappedFile const> const& file)
+{
+    FT_Face face;
+    FT_Error error = FT_New_Memory_Face(library, file->data(),
+        static_cast<FT_Long>(file->size()), 0, &face);
+    THROW_IF_FT_ERROR("FT_New_Memory_Face()");
+    // The face keeps the mapping alive until FreeType destroys it
+    face->generic.data = new std::shared_ptr<MappedFile const>(file);
+    face->generic.finalizer = [](void* object) {
+        FT_Face const face = static_cast<FT_Face>(object);
+        delete static_cast<std::shared_ptr<MappedFile const>*>(face->generic.data);
+    };
+    return face;
+}
+
+// FreeType objects private to a thread, to rasterize glyphs of a font in parallel.
+// Only used by their thread, but freed by the font.
+struct Font::_PrivateFace {
+    FT_Library_Ptr library;     // Destroyed last
+    FT_Face_Ptr face;
+    FT_Stroker_Ptr stroker;
+    std::map<int, FT_Size> sizes;   // Scaled sizes by charsize, owned by the face
+    FT_UInt hdpi{ 0 }, vdpi{ 0 };   // DPI the sizes were scaled with
+    int stroker_size{ 0 };
+};
+
+// Missing glyphs, claimed one by one by the threads rasterizing them
+struct GlyphBatch {
+    std::vector<FT_UInt> glyph_indexes;
+    std::atomic<size_t> next{ 0 };  // Next glyph to claim
+    std::atomic<size_t> done{ 0 };  // Number of processed glyphs
+    std::mutex mutex;
+    std::condition_variable finished;
+};
+
 // --- Constructor & Destructor ---
 
 // Constructor, inits FreeType if called for the first time.
@@ -23,11 +61,16 @@ Font::Font(std::string const& font_file) try
         throw_exc("Could not find '" + font_file + "' anywhere.");
     }
     
-    FT_Face face;
-    FT_Error error = FT_New_Face(Lib::getPtr(), font_path.c_str(), 0, &face);
-    THROW_IF_FT_ERROR("FT_New_Face()");
-    _face.reset(face);
+    // Map the file, sharing the mapping with other faces of the same file
+    _file = MappedFile::share(font_path);
+    if (!_file) {
+        throw_exc("Could not map '" + font_path + "'.");
+    }
+    _face.reset(newMemoryFace(Lib::getPtr(), _file));
     _font_name = _face->family_name;
+    if (!GlyphDiskCache::getDirectory().empty()) {
+        _file_hash = GlyphDiskCache::hashFont(_file->data(), _file->size());
+    }
 
     if (Log::TR::Fonts::query(Log::TR::Fonts::get().life_state)) {
         char buff[256];
@@ -42,7 +85,8 @@ CATCH_AND_RETHROW_METHOD_EXC;
 Font::~Font() noexcept
 {
     _font_sizes.clear();
-    _face.release();
+    _private_faces.clear();
+    _face.reset();
 
     if (Log::TR::Fonts::query(Log::TR::Fonts::get().life_state)) {
         char buff[256];
@@ -56,35 +100,93 @@ Font::~Font() noexcept
 // Call this function whenever changing charsize
 void Font::setCharsize(int charsize) try
 {
-    if (charsize <= 0) {
-        charsize = 1;
-    }
-    // Create font size if needed (which sets the charsize)
-    if (_font_sizes.count(charsize) == 0) {
-        _font_sizes.emplace(
-            std::piecewise_construct,
-            std::forward_as_tuple(charsize),                // Key
-            std::forward_as_tuple(_face.get(), charsize)    // Constructor values
-        );
-    }
-    else {
-        _font_sizes.at(charsize).setCharsize();
-    }
+    std::lock_guard<std::mutex> const lock(_face_mutex);
+    _setCharsize(charsize);
+}
+CATCH_AND_RETHROW_METHOD_EXC;
+
+// Shapes given buffer with given charsize
+void Font::shape(hb_buffer_t* buffer, int charsize) try
+{
+    // HarfBuzz reads the face's current charsize
+    std::lock_guard<std::mutex> const lock(_face_mutex);
+    hb_shape(_setCharsize(charsize).getHBFont(), buffer, nullptr, 0);
 }
 CATCH_AND_RETHROW_METHOD_EXC;
 
 // Loads corresponding glyph.
 bool Font::loadGlyph(FT_UInt glyph_index, int charsize, int outline_size) try
 {
-    _throw_if_bad_charsize(charsize);
-    return _font_sizes.at(charsize).loadGlyph(glyph_index, outline_size);
+    FontSize const* font_size = _findFontSize(charsize);
+    if (font_size && font_size->isLoaded(glyph_index, outline_size)) {
+        return false;
+    }
+    std::lock_guard<std::mutex> const lock(_face_mutex);
+    return _setCharsize(charsize).loadGlyph(glyph_index, outline_size);
+}
+CATCH_AND_RETHROW_METHOD_EXC;
+
+// Loads given glyphs, rasterizing missing ones in parallel if there are enough
+void Font::loadGlyphs(std::vector<FT_UInt> const& glyph_indexes, int charsize, int outline_size) try
+{
+    if (charsize <= 0) {
+        charsize = 1;
+    }
+    FontSize* font_size;
+    {
+        std::lock_guard<std::mutex> const lock(_face_mutex);
+        font_size = &_setCharsize(charsize);
+    }
+    std::shared_ptr<GlyphBatch> const batch = std::make_shared<GlyphBatch>();
+    for (FT_UInt const glyph_index : glyph_indexes) {
+        if (!font_size->isLoaded(glyph_index, outline_size))
+            batch->glyph_indexes.push_back(glyph_index);
+    }
+    size_t const count = batch->glyph_indexes.size();
+    size_t const helpers = std::min<size_t>(RenderPool::getThreadCount(), count / _min_parallel_glyphs);
+    if (helpers == 0) {
+        for (FT_UInt const glyph_index : batch->glyph_indexes) {
+            loadGlyph(glyph_index, charsize, outline_size);
+        }
+        return;
+    }
+    // Glyphs are claimed one by one, so the caller only waits for glyphs being
+    // rasterized, and never for jobs which didn't start (they then do nothing)
+    auto const work = [this, batch, font_size, charsize, outline_size]() {
+        size_t const count = batch->glyph_indexes.size();
+        for (size_t i = batch->next++; i < count; i = batch->next++) {
+            try {
+                _loadGlyphPrivate(*font_size, batch->glyph_indexes[i], charsize, outline_size);
+            }
+            catch (...) {
+                // Glyphs which failed to load are retried by the caller's loadGlyph()
+            }
+            if (++batch->done == count) {
+                {
+                    std::lock_guard<std::mutex> const lock(batch->mutex);
+                }
+                batch->finished.notify_all();
+            }
+        }
+    };
+    for (size_t i = 0; i < helpers; ++i) {
+        RenderPool::submit(work, INT_MAX);
+    }
+    work();
+    std::unique_lock<std::mutex> lock(batch->mutex);
+    batch->finished.wait(lock, [&batch, count]() { return batch->done == count; });
 }
 CATCH_AND_RETHROW_METHOD_EXC;
 
 // Clears out the internal glyph cache.
 void Font::unloadGlyphs() noexcept
 {
-    _font_sizes.clear();
+    {
+        std::lock_guard<std::mutex> const face_lock(_face_mutex);
+        std::unique_lock<std::shared_mutex> const lock(_mutex);
+        _font_sizes.clear();
+    }
+    Lib::invalidateGlyphs();
     if (Log::TR::Fonts::query(Log::TR::Fonts::get().glyph_load)) {
         char buff[256];
         sprintf_s(buff, "Unloaded all glyphs from '%s'", _face->family_name);
@@ -92,13 +194,40 @@ void Font::unloadGlyphs() noexcept
     }
 }
 
+// Saves & closes the persistent glyph cache of all charsizes, before DPI changes
+void Font::closeDiskCaches() noexcept
+{
+    std::shared_lock<std::shared_mutex> const lock(_mutex);
+    for (auto& [charsize, font_size] : _font_sizes) {
+        font_size.closeDiskCache();
+    }
+}
+
+// Marks given atlas pages of given charsize as used, if it is loaded
+void Font::touchPages(int charsize, std::vector<uint32_t> const& pages) const noexcept
+{
+    FontSize const* font_size = _findFontSize(charsize);
+    if (font_size) {
+        font_size->touchPages(pages);
+    }
+}
+
+// Lists atlas pages of all charsizes holding none of the given bitmaps
+void Font::listUnpinnedPages(std::unordered_set<Bitmap const*> const& pinned,
+    std::vector<FontSize::Page>& pages)
+{
+    std::shared_lock<std::shared_mutex> const lock(_mutex);
+    for (auto& [charsize, font_size] : _font_sizes) {
+        font_size.listUnpinnedPages(pinned, pages);
+    }
+}
+
     // --- Get functions ---
 
 // Returns the corresponding internal HarfBuzz font.
 hb_font_t* Font::getHBFont(int charsize) const try
 {
-    _throw_if_bad_charsize(charsize);
-    return _font_sizes.at(charsize).getHBFont();
+    return _getFontSize(charsize).getHBFont();
 }
 CATCH_AND_RETHROW_METHOD_EXC;
 
@@ -106,8 +235,7 @@ CATCH_AND_RETHROW_METHOD_EXC;
 _internal::Bitmap const&
 Font::getGlyphBitmap(FT_UInt glyph_index, int charsize) const try
 {
-    _throw_if_bad_charsize(charsize);
-    return _font_sizes.at(charsize).getGlyphBitmap(glyph_index);
+    return _getFontSize(charsize).getGlyphBitmap(glyph_index);
 }
 CATCH_AND_RETHROW_METHOD_EXC;
 
@@ -115,22 +243,106 @@ CATCH_AND_RETHROW_METHOD_EXC;
 _internal::Bitmap const&
 Font::getOutlineBitmap(FT_UInt glyph_index, int charsize, int outline_size) const try
 {
-    _throw_if_bad_charsize(charsize);
-    return _font_sizes.at(charsize).getOutlineBitmap(glyph_index, outline_size);
+    return _getFontSize(charsize).getOutlineBitmap(glyph_index, outline_size);
 }
 CATCH_AND_RETHROW_METHOD_EXC;
 
     // --- Private functions ---
 
-// Ensures the given charsize has been initialized
-void Font::_throw_if_bad_charsize(int &charsize) const
+// Returns the given charsize, or nullptr if it wasn't initialized.
+// Font sizes are never moved, so the pointer outlives the lock.
+FontSize const* Font::_findFontSize(int charsize) const
 {
     if (charsize <= 0) {
         charsize = 1;
     }
-    if (_font_sizes.count(charsize) == 0) {
+    std::shared_lock<std::shared_mutex> const lock(_mutex);
+    auto const it = _font_sizes.find(charsize);
+    return it != _font_sizes.cend() ? &it->second : nullptr;
+}
+
+// Returns the given charsize, throws if it wasn't initialized.
+FontSize const& Font::_getFontSize(int charsize) const
+{
+    FontSize const* font_size = _findFontSize(charsize);
+    if (!font_size) {
         throw_exc("No loaded charsize of given parameter");
     }
+    return *font_size;
+}
+
+FontSize& Font::_setCharsize(int charsize)
+{
+    if (charsize <= 0) {
+        charsize = 1;
+    }
+    {
+        std::shared_lock<std::shared_mutex> const lock(_mutex);
+        auto const it = _font_sizes.find(charsize);
+        if (it != _font_sizes.end()) {
+            it->second.setCharsize();
+            return it->second;
+        }
+    }
+    // Create font size (which sets the charsize)
+    std::unique_lock<std::shared_mutex> const lock(_mutex);
+    return _font_sizes.emplace(
+        std::piecewise_construct,
+        std::forward_as_tuple(charsize),                // Key
+        std::forward_as_tuple(_face.get(), charsize, _file_hash) // Constructor values
+    ).first->second;
+}
+
+// Loads given glyph with this thread's private face
+bool Font::_loadGlyphPrivate(FontSize& font_size, FT_UInt glyph_index, int charsize, int outline_size)
+{
+    _PrivateFace* private_face;
+    {
+        std::lock_guard<std::mutex> const lock(_private_faces_mutex);
+        std::unique_ptr<_PrivateFace>& ptr = _private_faces[std::this_thread::get_id()];
+        if (!ptr) {
+            ptr = std::make_unique<_PrivateFace>();
+        }
+        private_face = ptr.get();
+    }
+    _PrivateFace& state = *private_face;
+    if (!state.face) {
+        FT_Library library;
+        FT_Error error = FT_Init_FreeType(&library);
+        THROW_IF_FT_ERROR("FT_Init_FreeType()");
+        state.library.reset(library);
+        state.face.reset(newMemoryFace(library, _file));
+        FT_Stroker stroker;
+        error = FT_Stroker_New(library, &stroker);
+        THROW_IF_FT_ERROR("FT_Stroker_New()");
+        state.stroker.reset(stroker);
+    }
+    // Activate the charsize's FT_Size, creating it if needed
+    FT_UInt hdpi, vdpi;
+    Lib::getDPI(hdpi, vdpi);
+    if (hdpi != state.hdpi || vdpi != state.vdpi) {
+        for (auto const& [size_charsize, ft_size] : state.sizes) {
+            FT_Done_Size(ft_size);
+        }
+        state.sizes.clear();
+        state.hdpi = hdpi;
+        state.vdpi = vdpi;
+    }
+    auto size = state.sizes.find(charsize);
+    if (size == state.sizes.end()) {
+        FT_Size ft_size;
+        FT_Error error = FT_New_Size(state.face.get(), &ft_size);
+        THROW_IF_FT_ERROR("FT_New_Size()");
+        size = state.sizes.emplace(charsize, ft_size).first;
+        FT_Activate_Size(ft_size);
+        error = FT_Set_Char_Size(state.face.get(), charsize << 6, 0, hdpi, vdpi);
+        THROW_IF_FT_ERROR("FT_Set_Char_Size()");
+    }
+    else {
+        FT_Activate_Size(size->second);
+    }
+    return font_size.loadGlyph(glyph_index, outline_size,
+        state.face.get(), state.stroker.get(), state.stroker_size);
 }
 
 INTERNAL_END;
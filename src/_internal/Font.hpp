@@ -2,6 +2,7 @@
 #define SSS_TR_FONT_HPP
 
 #include "FontSize.hpp"
+#include <thread>
 
 /** @file
  *  Defines the internal font management class.
@@ -14,6 +15,9 @@ INTERNAL_BEGIN;
 class Lib; // Pre-declaration
 /** \endcond */
 
+// Safe for concurrent readers : FreeType calls on the face (charsize changes,
+// shaping, glyph loading) are serialized, while bitmap lookups only share
+// locks on the maps, which are blocked solely while new entries are stored.
 class Font {
     friend Lib;
 public:
@@ -30,10 +34,22 @@ public:
 // --- Glyph functions ---
 
     void setCharsize(int charsize);
+    // Shapes given buffer with given charsize
+    void shape(hb_buffer_t* buffer, int charsize);
     // Loads corresponding glyph.
     bool loadGlyph(FT_UInt glyph_index, int charsize, int outline_size);
+    // Loads given glyphs. Missing ones are rasterized in parallel on the
+    // render pool if there are enough of them, each thread using its own face.
+    void loadGlyphs(std::vector<FT_UInt> const& glyph_indexes, int charsize, int outline_size);
     // Clears out the internal glyph cache.
     void unloadGlyphs() noexcept;
+    // Saves & closes the persistent glyph cache of all charsizes, before DPI changes
+    void closeDiskCaches() noexcept;
+    // Marks given atlas pages of given charsize as used, if it is loaded
+    void touchPages(int charsize, std::vector<uint32_t> const& pages) const noexcept;
+    // Lists atlas pages of all charsizes holding none of the given bitmaps
+    void listUnpinnedPages(std::unordered_set<Bitmap const*> const& pinned,
+        std::vector<FontSize::Page>& pages);
 
 // --- Get functions ---
 
@@ -53,15 +69,38 @@ private:
 
     // Font family name
     std::string _font_name;
+    // Hash of the font file, keying the persistent glyph cache (0 if disabled)
+    uint64_t _file_hash{ 0 };
+    // Mapped font file, shared with thread-private faces
+    std::shared_ptr<MappedFile const> _file;
+    // FreeType objects private to a thread, to rasterize glyphs in parallel
+    struct _PrivateFace;
+    // Private faces by thread, freed along with the font
+    std::map<std::thread::id, std::unique_ptr<_PrivateFace>> _private_faces;
+    std::mutex _private_faces_mutex; // Guards _private_faces
     // Font face
     FT_Face_Ptr _face;
     // Map of different font charsizes
     FontSize::Map _font_sizes;
+    // Guards _font_sizes : many readers, one writer
+    mutable std::shared_mutex _mutex;
+    // Serializes FreeType & HarfBuzz calls using _face
+    std::mutex _face_mutex;
 
 // --- Private functions ---
 
-    // Ensures the given charsize has been initialized
-    void _throw_if_bad_charsize(int &charsize) const;
+    // Returns the given charsize, or nullptr if it wasn't initialized
+    FontSize const* _findFontSize(int charsize) const;
+    // Returns the given charsize, throws if it wasn't initialized
+    FontSize const& _getFontSize(int charsize) const;
+    // Sets the face's charsize, creating the font size if needed.
+    // _face_mutex must be locked.
+    FontSize& _setCharsize(int charsize);
+    // Loads given glyph with this thread's private face
+    bool _loadGlyphPrivate(FontSize& font_size, FT_UInt glyph_index, int charsize, int outline_size);
+
+    // Minimum number of missing glyphs per thread to rasterize them in parallel
+    static constexpr size_t _min_parallel_glyphs = 16;
 };
 
 
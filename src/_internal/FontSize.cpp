@@ -4,19 +4,29 @@ SSS_TR_BEGIN;
 INTERNAL_BEGIN;
 
 // Constructor, throws if invalid charsize
-FontSize::FontSize(FT_Face ft_face, int charsize) try
-    : _charsize(charsize), _ft_face(ft_face)
+FontSize::FontSize(FT_Face ft_face, int charsize, uint64_t font_hash) try
+    : _charsize(charsize), _ft_face(ft_face), _atlas(GlyphAtlas::pageSizeFor(charsize))
 {
     if (charsize <= 0) {
         throw_exc("negative charsize not allowed.");
     }
+    // Map glyphs rasterized by previous runs
+    if (font_hash != 0 && !GlyphDiskCache::getDirectory().empty()) {
+        _disk_cache = std::make_unique<GlyphDiskCache>(font_hash, charsize);
+    }
+    // Create this charsize's own FT_Size, so switching charsizes
+    // doesn't rescale the face each time
+    FT_Size ft_size;
+    FT_Error error = FT_New_Size(ft_face, &ft_size);
+    THROW_IF_FT_ERROR("FT_New_Size()");
+    _ft_size = ft_size;
     // Set charsize
     setCharsize();
     // Create HarfBuzz font from FreeType font face.
     _hb_font.reset(hb_ft_font_create_referenced(ft_face));
     // Create Stroker
     FT_Stroker stroker;
-    FT_Error error = FT_Stroker_New(Lib::getPtr(), &stroker);
+    error = FT_Stroker_New(Lib::getPtr(), &stroker);
     THROW_IF_FT_ERROR("FT_Stroker_New()");
     _stroker.reset(stroker);
 
@@ -31,10 +41,14 @@ CATCH_AND_RETHROW_METHOD_EXC;
 // Destructor. Logs
 FontSize::~FontSize()
 {
-    _originals.clear();
-    _outlined.clear();
+    _saveToDisk();
+    _bitmaps.clear();
+    _atlas.clear();
     _hb_font.release();
     _stroker.release();
+    if (_ft_size) {
+        FT_Done_Size(_ft_size);
+    }
     
     if (Log::TR::Fonts::query(Log::TR::Fonts::get().life_state)) {
         char buff[256];
@@ -45,7 +59,10 @@ FontSize::~FontSize()
 
     // --- Glyph functions ---
 
-static FT_Error _convertGlyph(FT_Glyph ft_glyph, Bitmap& bitmap)
+// Converts given glyph to a bitmap, and stores it in the atlas & table.
+// Rasterization happens before locking, so readers are only blocked
+// while pixels are copied.
+FT_Error FontSize::_convertGlyph(FT_Glyph ft_glyph, FT_UInt glyph_index, int outline_size)
 {
     // Convert glyph to bitmap.
     // This frees the glyph (when last parameter is set to true) and allocates a bitmap
@@ -56,6 +73,7 @@ static FT_Error _convertGlyph(FT_Glyph ft_glyph, Bitmap& bitmap)
 
     FT_BitmapGlyph ft_bitmap = (FT_BitmapGlyph)ft_glyph;
 
+    Bitmap bitmap;
     bitmap.pen_left = ft_bitmap->left;
     bitmap.pen_top = ft_bitmap->top;
 
@@ -63,11 +81,16 @@ static FT_Error _convertGlyph(FT_Glyph ft_glyph, Bitmap& bitmap)
     bitmap.height = ft_bitmap->bitmap.rows;
     bitmap.bpp = ft_bitmap->bitmap.width == 0 ? 0 : bitmap.width / ft_bitmap->bitmap.width;
 
-    bitmap.buffer = std::vector<unsigned char>(
-        ft_bitmap->bitmap.buffer,
-        ft_bitmap->bitmap.buffer + (bitmap.width * bitmap.height)
-    );
     bitmap.pixel_mode = ft_bitmap->bitmap.pixel_mode;
+    {
+        // Copy pixels in the atlas, then publish the bitmap,
+        // unless another thread just did
+        std::unique_lock<std::shared_mutex> const lock(_mutex);
+        if (!_bitmaps.find(glyph_index, outline_size)) {
+            _atlas.insert(bitmap, ft_bitmap->bitmap.buffer, bitmap.width);
+            _bitmaps.insert(glyph_index, outline_size, bitmap);
+        }
+    }
 
     // Free FT allocated bitmap
     FT_Done_Glyph(ft_glyph);
@@ -75,66 +98,160 @@ static FT_Error _convertGlyph(FT_Glyph ft_glyph, Bitmap& bitmap)
     return false;
 }
 
+// Copies given glyph from the persistent cache, if stored there
+bool FontSize::_copyFromDisk(FT_UInt glyph_index, int outline_size)
+{
+    // Pixels are mapped from the file, keep it open while copying them
+    std::shared_lock<std::shared_mutex> const disk_lock(_disk_mutex);
+    Bitmap bitmap;
+    unsigned char const* pixels = nullptr;
+    if (!_disk_cache || !_disk_cache->find(glyph_index, outline_size, bitmap, pixels)) {
+        return false;
+    }
+    std::unique_lock<std::shared_mutex> const lock(_mutex);
+    if (!_bitmaps.find(glyph_index, outline_size)) {
+        _atlas.insert(bitmap, pixels, bitmap.width);
+        _bitmaps.insert(glyph_index, outline_size, bitmap);
+    }
+    return true;
+}
+
+// Writes all bitmaps to the persistent cache, if new ones were rasterized.
+// _disk_mutex must be locked, unless destroying.
+void FontSize::_saveToDisk() try
+{
+    if (!_disk_cache || !_disk_dirty) {
+        return;
+    }
+    // Bitmaps rasterized with another DPI than the file's don't belong there
+    if (!_disk_cache->isCurrentDPI()) {
+        LOG_FUNC_WRN("DPI changed since the glyph disk cache was opened, not saving it.");
+        return;
+    }
+    std::shared_lock<std::shared_mutex> const lock(_mutex);
+    _disk_cache->save(_bitmaps);
+    _disk_dirty = false;
+}
+CATCH_AND_LOG_METHOD_EXC;
+
+// Saves loaded bitmaps to the persistent cache, then stops using it.
+// Loaded bitmaps are kept on DPI changes, so the table would mix both DPIs
+// if the cache was reopened with the new one.
+void FontSize::closeDiskCache() noexcept
+{
+    std::unique_lock<std::shared_mutex> const disk_lock(_disk_mutex);
+    _saveToDisk();
+    _disk_cache.reset();
+}
+
+// Activates this charsize's FT_Size, scaling it on first use or if DPI changed
 void FontSize::setCharsize()
 {
+    FT_Error error = FT_Activate_Size(_ft_size);
+    THROW_IF_FT_ERROR("FT_Activate_Size()");
     // Get DPI
     FT_UInt hdpi, vdpi;
     Lib::getDPI(hdpi, vdpi);
+    if (hdpi == _hdpi && vdpi == _vdpi) {
+        return;
+    }
     // Set charsize
-    FT_Error error = FT_Set_Char_Size(_ft_face, _charsize << 6, 0, hdpi, vdpi);
+    error = FT_Set_Char_Size(_ft_face, _charsize << 6, 0, hdpi, vdpi);
     THROW_IF_FT_ERROR("FT_Set_Char_Size()");
+    _hdpi = hdpi;
+    _vdpi = vdpi;
 }
 
 // Loads the given glyph, and its ouline if outline_size > 0
 bool FontSize::loadGlyph(FT_UInt glyph_index, int outline_size) try
+{
+    return _loadGlyph(glyph_index, outline_size, nullptr, nullptr, _last_outline_size);
+}
+CATCH_AND_RETHROW_METHOD_EXC;
+
+// Loads the given glyph with given face & stroker instead of the shared ones
+bool FontSize::loadGlyph(FT_UInt glyph_index, int outline_size,
+    FT_Face ft_face, FT_Stroker stroker, int& stroker_size) try
+{
+    return _loadGlyph(glyph_index, outline_size, ft_face, stroker, stroker_size);
+}
+CATCH_AND_RETHROW_METHOD_EXC;
+
+// Loads the given glyph with given FreeType objects, or the shared ones if null
+bool FontSize::_loadGlyph(FT_UInt glyph_index, int outline_size,
+    FT_Face ft_face, FT_Stroker stroker, int& stroker_size)
 {
     // Check if glyph is already loaded
-    if (_originals.count(glyph_index) != 0 && (outline_size == 0
-         || (_outlined.count(outline_size) != 0
-            && _outlined.at(outline_size).count(glyph_index) != 0)))
+    bool has_original, has_outline = true;
     {
+        std::shared_lock<std::shared_mutex> const lock(_mutex);
+        has_original = _bitmaps.find(glyph_index, 0) != nullptr;
+        if (outline_size > 0) {
+            has_outline = _bitmaps.find(glyph_index, outline_size) != nullptr;
+        }
+    }
+    if (has_original && has_outline) {
         return false;
     }
-    // Set charsize
-    setCharsize();
+    // Copy bitmaps rasterized by previous runs, if any
+    if (!has_original) {
+        has_original = _copyFromDisk(glyph_index, 0);
+    }
+    if (!has_outline) {
+        has_outline = _copyFromDisk(glyph_index, outline_size);
+    }
+    if (has_original && has_outline) {
+        return false;
+    }
+    // Use shared FreeType objects, unless private ones were given
+    if (!ft_face) {
+        setCharsize();
+        ft_face = _ft_face;
+        stroker = _stroker.get();
+    }
 
     // Load glyph
-    FT_Error error = FT_Load_Glyph(_ft_face, glyph_index, FT_LOAD_DEFAULT);
+    FT_Error error = FT_Load_Glyph(ft_face, glyph_index, FT_LOAD_DEFAULT);
     LOG_FT_ERROR_AND_RETURN("FT_Load_Glyph()", true);
 
     // Retrieve glyph
     FT_Glyph original;
-    error = FT_Get_Glyph(_ft_face->glyph, &original);
+    error = FT_Get_Glyph(ft_face->glyph, &original);
     LOG_FT_ERROR_AND_RETURN("FT_Get_Glyph()", true);
 
     // Load its outline if needed
     FT_Glyph outlined = original;
-    if (outline_size > 0) {
+    if (!has_outline) {
         // Update stroker if needed
-        if (outline_size != _last_outline_size) {
-            _last_outline_size = outline_size;
-            FT_Stroker_Set(_stroker.get(), outline_size << 6,
+        if (outline_size != stroker_size) {
+            stroker_size = outline_size;
+            FT_Stroker_Set(stroker, outline_size << 6,
                 FT_STROKER_LINECAP_ROUND, FT_STROKER_LINEJOIN_ROUND, 0);
         }
 
         // Create a stroked variant of the original glyph
-        FT_Error error = FT_Glyph_Stroke(&outlined, _stroker.get(), false);
+        FT_Error error = FT_Glyph_Stroke(&outlined, stroker, false);
         LOG_FT_ERROR_AND_RETURN("FT_Glyph_Stroke()", true);
     }
 
     // Convert the glyph to bitmap, if needed
-    if (_originals.count(glyph_index) == 0) {
-        error = _convertGlyph(original, _originals[glyph_index]);
+    if (!has_original) {
+        error = _convertGlyph(original, glyph_index, 0);
         LOG_FT_ERROR_AND_RETURN("FT_Glyph_To_Bitmap()", true);
     }
+    else {
+        FT_Done_Glyph(original);
+    }
 
     // Store outline bitmap if needed
-    if (outline_size > 0) {
+    if (!has_outline) {
         // Convert the glyph to bitmap
-        error = _convertGlyph(outlined, _outlined[outline_size][glyph_index]);
+        error = _convertGlyph(outlined, glyph_index, outline_size);
         LOG_FT_ERROR_AND_RETURN("FT_Glyph_To_Bitmap()", true);
     }
 
+    _disk_dirty = true;
+
     if (Log::TR::Fonts::query(Log::TR::Fonts::get().glyph_load)) {
         char buff[256];
         sprintf_s(buff, "Loaded '%s' -> size %03d -> glyph id '%u'",
@@ -144,32 +261,89 @@ bool FontSize::loadGlyph(FT_UInt glyph_index, int outline_size) try
 
     return false;
 }
-CATCH_AND_RETHROW_METHOD_EXC;
+
+// Whether the given glyph, and its outline if outline_size > 0, are loaded
+bool FontSize::isLoaded(FT_UInt glyph_index, int outline_size) const
+{
+    std::shared_lock<std::shared_mutex> const lock(_mutex);
+    if (!_bitmaps.find(glyph_index, 0)) {
+        return false;
+    }
+    return outline_size <= 0 || _bitmaps.find(glyph_index, outline_size);
+}
 
 // Returns the corresponding glyph's bitmap. Throws if not found.
+// Records are never moved, so the reference outlives the lock.
 Bitmap const& FontSize::getGlyphBitmap(FT_UInt glyph_index) const try
 {
-    if (_originals.count(glyph_index) == 0) {
+    std::shared_lock<std::shared_mutex> const lock(_mutex);
+    Bitmap const* bitmap = _bitmaps.find(glyph_index, 0);
+    if (!bitmap) {
         throw_exc("No glyph found for given index.");
     }
     // Retrieve bitmap from cache
-    return _originals.at(glyph_index);
+    if (bitmap->buffer)
+        _atlas.touch(bitmap->page, Lib::getFrame());
+    return *bitmap;
 }
 CATCH_AND_RETHROW_METHOD_EXC;
 
 // Returns the corresponding glyph outline's bitmap. Throws if not found.
 Bitmap const& FontSize::getOutlineBitmap(FT_UInt glyph_index, int outline_size) const try
 {
-    if (_outlined.count(outline_size) == 0) {
-        throw_exc("No map found for given outline size.");
-    }
-    if (_outlined.at(outline_size).count(glyph_index) == 0) {
+    std::shared_lock<std::shared_mutex> const lock(_mutex);
+    Bitmap const* bitmap = outline_size > 0 ? _bitmaps.find(glyph_index, outline_size) : nullptr;
+    if (!bitmap) {
         throw_exc("No glyph found for given index & outline size.");
     }
     // Retrieve bitmap from cache
-    return _outlined.at(outline_size).at(glyph_index);
+    if (bitmap->buffer)
+        _atlas.touch(bitmap->page, Lib::getFrame());
+    return *bitmap;
 }
 CATCH_AND_RETHROW_METHOD_EXC;
 
+    // --- Eviction functions ---
+
+// Marks given atlas pages as used by the current frame
+void FontSize::touchPages(std::vector<uint32_t> const& pages) const noexcept
+{
+    std::shared_lock<std::shared_mutex> const lock(_mutex);
+    uint64_t const frame = Lib::getFrame();
+    for (uint32_t const page : pages) {
+        _atlas.touch(page, frame);
+    }
+}
+
+// Lists atlas pages holding none of the given bitmaps.
+// Empty bitmaps have no page, and are never evicted.
+void FontSize::listUnpinnedPages(std::unordered_set<Bitmap const*> const& pinned, std::vector<Page>& pages)
+{
+    std::shared_lock<std::shared_mutex> const lock(_mutex);
+    std::vector<bool> is_pinned(_atlas.getPageCount(), false);
+    _bitmaps.forEach([&](FT_UInt, int, Bitmap const& bitmap) {
+        if (bitmap.buffer && pinned.count(&bitmap) != 0)
+            is_pinned[bitmap.page] = true;
+    });
+    for (uint32_t i = 0; i < _atlas.getPageCount(); ++i) {
+        if (!is_pinned[i] && _atlas.getPageSize(i) != 0)
+            pages.push_back(Page{ this, i, _atlas.getLastUse(i) });
+    }
+}
+
+// Removes all bitmaps stored in given atlas page, then frees it
+void FontSize::evictPage(uint32_t index) noexcept
+{
+    std::unique_lock<std::shared_mutex> const lock(_mutex);
+    _bitmaps.erasePage(index);
+    _atlas.freePage(index);
+    if (Log::TR::Fonts::query(Log::TR::Fonts::get().glyph_load)) {
+        char buff[256];
+        sprintf_s(buff, "Evicted '%s' -> size %03d -> atlas page %u",
+            _ft_face->family_name, _charsize, index);
+        LOG_TR_MSG(buff);
+    }
+}
+
 INTERNAL_END;
 SSS_TR_END
\ No newline at end of file
@@ -1,7 +1,7 @@
 #ifndef SSS_TR_FONTSIZE_HPP
 #define SSS_TR_FONTSIZE_HPP
 
-#include "Lib.hpp"
+#include "GlyphDiskCache.hpp"
 
 /** @file
  *  Defines internal font sizes management classes.
@@ -21,20 +21,10 @@ namespace SSS::Log::TR {
 SSS_TR_BEGIN;
 INTERNAL_BEGIN;
 
-struct Bitmap {
-    int pen_left;
-    int pen_top;
-
-    int width;
-    int height;
-    int bpp;
-
-    std::vector<unsigned char> buffer;
-    unsigned char pixel_mode;
-};
-
 // This class aims to be used within the Font class to load, store,
 // and access glyphs (and their possible outlines) of a given charsize.
+// Getters may be called from any thread. Loading glyphs calls FreeType,
+// which the owning Font serializes per face.
 class FontSize {
 public:
 // --- Aliases ---
@@ -42,24 +32,50 @@ public:
 
 // --- Constructor & Destructor ---
 
-    // Constructor, throws if invalid charsize
-    FontSize(FT_Face ft_face, int charsize);
-    // Destructor. Logs
+    // Constructor, throws if invalid charsize.
+    // Uses the persistent glyph cache if enabled and font_hash != 0.
+    FontSize(FT_Face ft_face, int charsize, uint64_t font_hash = 0);
+    // Destructor. Saves newly rasterized glyphs to disk, if enabled. Logs
     ~FontSize();
 
 // --- Load functions ---
 
-    // Change FT face charsize
+    // Activates this charsize's FT_Size on the face (cheap unless DPI changed)
     void setCharsize();
     // Loads the given glyph, and its ouline if outline_size > 0.
     // Returns true on error.
     bool loadGlyph(FT_UInt glyph_index, int outline_size);
+    // Loads the given glyph with given face & stroker instead of the shared
+    // ones, so that threads owning them can rasterize glyphs in parallel.
+    // The face must be set to this charsize. Returns true on error.
+    bool loadGlyph(FT_UInt glyph_index, int outline_size,
+        FT_Face ft_face, FT_Stroker stroker, int& stroker_size);
+    // Whether the given glyph, and its outline if outline_size > 0, are loaded
+    bool isLoaded(FT_UInt glyph_index, int outline_size) const;
+    // Saves loaded bitmaps to the persistent cache, then stops using it.
+    // Called before DPI changes, as the cache is keyed by the previous one.
+    void closeDiskCache() noexcept;
+
+// --- Eviction functions ---
+
+    // An atlas page, listed for eviction
+    struct Page {
+        FontSize* font_size{ nullptr };
+        uint32_t index{ 0 };
+        uint64_t last_use{ 0 }; // Lib::getFrame() when last used
+    };
+    // Marks given atlas pages as used by the current frame
+    void touchPages(std::vector<uint32_t> const& pages) const noexcept;
+    // Lists atlas pages holding none of the given bitmaps
+    void listUnpinnedPages(std::unordered_set<Bitmap const*> const& pinned, std::vector<Page>& pages);
+    // Removes all bitmaps stored in given atlas page, then frees it
+    void evictPage(uint32_t index) noexcept;
 
 // --- Get functions ---
 
-    // Returns the corresponding glyph's bitmap. Throws if not found.
+    // Returns the corresponding glyph's bitmap, marking it as used. Throws if not found.
     Bitmap const& getGlyphBitmap(FT_UInt glyph_index) const;
-    // Returns the corresponding glyph outline's bitmap. Throws if not found.
+    // Returns the corresponding glyph outline's bitmap, marking it as used. Throws if not found.
     Bitmap const& getOutlineBitmap(FT_UInt glyph_index, int outline_size) const;
     // Returns the corresponding HarfBuzz font
     inline hb_font_t* getHBFont() const noexcept { return _hb_font.get(); }
@@ -72,11 +88,28 @@ private:
     HB_Font_Ptr _hb_font;           // HarfBuzz font, created here
     FT_Stroker_Ptr _stroker;        // FreeType stroker, created here
     FT_Face _ft_face;               // FreeType font face, given
-
-    // Map of glyph bitmaps
-    std::map<FT_UInt, Bitmap> _originals;
-    // Map of outline bitmaps, mapped by outline size
-    std::map<FT_UInt, std::map<FT_UInt, Bitmap>> _outlined;
+    FT_Size _ft_size{ nullptr };    // FreeType size of this charsize, owned by the face
+    FT_UInt _hdpi{ 0 }, _vdpi{ 0 }; // DPI _ft_size was scaled with
+    GlyphAtlas _atlas;              // Pixels of all bitmaps below
+
+    // Glyph & outline bitmaps, by glyph index & outline size (0 for glyphs)
+    BitmapTable _bitmaps;
+    // Guards the table & the atlas : many readers, one writer
+    mutable std::shared_mutex _mutex;
+    // Bitmaps rasterized by previous runs, if enabled
+    std::unique_ptr<GlyphDiskCache> _disk_cache;
+    std::atomic<bool> _disk_dirty{ false }; // Whether glyphs were rasterized since
+    mutable std::shared_mutex _disk_mutex;  // Guards _disk_cache, locked before _mutex
+
+    // Converts given glyph to a bitmap, and stores it in the atlas & table
+    FT_Error _convertGlyph(FT_Glyph ft_glyph, FT_UInt glyph_index, int outline_size);
+    // Loads the given glyph with given FreeType objects, or the shared ones if null
+    bool _loadGlyph(FT_UInt glyph_index, int outline_size,
+        FT_Face ft_face, FT_Stroker stroker, int& stroker_size);
+    // Copies given glyph from the persistent cache, if stored there
+    bool _copyFromDisk(FT_UInt glyph_index, int outline_size);
+    // Writes all bitmaps to the persistent cache, if new ones were rasterized
+    void _saveToDisk();
 };
 
 INTERNAL_END;
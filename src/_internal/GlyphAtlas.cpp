@@ -0,0 +1,257 @@
+#include "GlyphAtlas.hpp"
+
+SSS_TR_BEGIN;
+INTERNAL_BEGIN;
+
+GlyphAtlas::GlyphAtlas(int page_size)
+    : _page_size(page_size)
+{
+}
+
+GlyphAtlas::~GlyphAtlas() noexcept
+{
+    clear();
+}
+
+void GlyphAtlas::insert(Bitmap& bitmap, unsigned char const* src, int src_pitch)
+{
+    int const w = bitmap.width, h = bitmap.height;
+    if (w <= 0 || h <= 0) {
+        bitmap.buffer = nullptr;
+        return;
+    }
+
+    int x = 0, y = 0;
+    size_t index = 0;
+    // Look for room in existing pages, most recent first
+    for (index = _pages.size(); index != 0; --index) {
+        if (_allocate(_pages[index - 1], w, h, x, y))
+            break;
+    }
+    if (index == 0) {
+        // Reuse a freed page slot, or create a new page
+        for (index = 1; index <= _pages.size() && _pages[index - 1].w != 0; ++index);
+        if (index > _pages.size())
+            _pages.emplace_back();
+        // Dedicate the page to the glyph if it's too large
+        _Page& page = _pages[index - 1];
+        page.w = std::max(w, _page_size);
+        page.h = std::max(h, _page_size);
+        page.pixels.resize(static_cast<size_t>(page.w) * static_cast<size_t>(page.h));
+        Lib::addGlyphMemory(page.pixels.size());
+        _allocate(page, w, h, x, y);
+    }
+    --index;
+
+    _Page& page = _pages[index];
+    page.last_use = Lib::getFrame();
+    bitmap.page = static_cast<uint32_t>(index);
+    bitmap.x = x;
+    bitmap.y = y;
+    bitmap.pitch = page.w;
+    unsigned char* dst = &page.pixels[static_cast<size_t>(x) + static_cast<size_t>(y) * page.w];
+    bitmap.buffer = dst;
+    // Copy rows
+    for (int j = 0; j < h; ++j) {
+        std::copy(src, src + w, dst);
+        src += src_pitch;
+        dst += page.w;
+    }
+}
+
+void GlyphAtlas::clear() noexcept
+{
+    Lib::removeGlyphMemory(getMemorySize());
+    _pages.clear();
+}
+
+void GlyphAtlas::freePage(uint32_t page) noexcept
+{
+    if (page >= _pages.size())
+        return;
+    _Page& freed = _pages[page];
+    Lib::removeGlyphMemory(freed.pixels.size());
+    freed.w = 0;
+    freed.h = 0;
+    freed.used_h = 0;
+    freed.shelves = std::vector<_Shelf>();
+    freed.pixels = std::vector<unsigned char>();
+}
+
+void GlyphAtlas::touch(uint32_t page, uint64_t frame) const noexcept
+{
+    if (page < _pages.size())
+        _pages[page].last_use.store(frame, std::memory_order_relaxed);
+}
+
+uint64_t GlyphAtlas::getLastUse(uint32_t page) const noexcept
+{
+    return page < _pages.size() ? _pages[page].last_use.load(std::memory_order_relaxed) : 0;
+}
+
+size_t GlyphAtlas::getPageSize(uint32_t page) const noexcept
+{
+    return page < _pages.size() ? _pages[page].pixels.size() : 0;
+}
+
+size_t GlyphAtlas::getMemorySize() const noexcept
+{
+    size_t size = 0;
+    for (_Page const& page : _pages) {
+        size += page.pixels.size();
+    }
+    return size;
+}
+
+int GlyphAtlas::pageSizeFor(int charsize) noexcept
+{
+    // Enough room for a couple hundred glyphs of given charsize
+    int size = 128;
+    while (size < charsize * 16 && size < 1024) {
+        size <<= 1;
+    }
+    return size;
+}
+
+bool GlyphAtlas::_allocate(_Page& page, int w, int h, int& x, int& y)
+{
+    if (w > page.w)
+        return false;
+    // Find the first shelf that fits, without wasting too much height
+    for (_Shelf& shelf : page.shelves) {
+        if (shelf.height >= h && shelf.height <= h + h / 2 && page.w - shelf.x >= w) {
+            x = shelf.x;
+            y = shelf.y;
+            shelf.x += w;
+            return true;
+        }
+    }
+    // Open a new shelf
+    if (page.h - page.used_h < h)
+        return false;
+    _Shelf& shelf = page.shelves.emplace_back();
+    shelf.y = page.used_h;
+    shelf.height = h;
+    shelf.x = w;
+    page.used_h += h;
+    x = 0;
+    y = shelf.y;
+    return true;
+}
+
+Bitmap const* BitmapTable::find(FT_UInt glyph_index, int outline_size) const noexcept
+{
+    if (_slots.empty())
+        return nullptr;
+    uint64_t const key = _key(glyph_index, outline_size);
+    size_t const mask = _slots.size() - 1;
+    for (size_t i = _home(key); _slots[i].record != _empty; i = (i + 1) & mask) {
+        if (_slots[i].key == key)
+            return &_record(_slots[i].record);
+    }
+    return nullptr;
+}
+
+Bitmap const& BitmapTable::insert(FT_UInt glyph_index, int outline_size, Bitmap const& bitmap)
+{
+    if (Bitmap const* stored = find(glyph_index, outline_size))
+        return *stored;
+    // Keep the load factor under 3/4
+    if ((_size + 1) * 4 > _slots.size() * 3)
+        _rehash(std::max<size_t>(_slots.size() * 2, 64));
+    // Reuse an erased record, or allocate a new one
+    uint32_t record;
+    if (!_free_records.empty()) {
+        record = _free_records.back();
+        _free_records.pop_back();
+    }
+    else {
+        record = _record_count++;
+        if ((record >> _chunk_bits) == _chunks.size())
+            _chunks.push_back(std::make_unique<Bitmap[]>(_chunk_mask + 1));
+        // Erasing records must not allocate
+        if (_free_records.capacity() < _record_count)
+            _free_records.reserve(static_cast<size_t>(_record_count) * 2);
+    }
+    _record(record) = bitmap;
+    // Place it in the first empty slot
+    uint64_t const key = _key(glyph_index, outline_size);
+    size_t const mask = _slots.size() - 1;
+    size_t i = _home(key);
+    while (_slots[i].record != _empty)
+        i = (i + 1) & mask;
+    _slots[i] = _Slot{ key, record };
+    ++_size;
+    return _record(record);
+}
+
+void BitmapTable::erasePage(uint32_t page) noexcept
+{
+    if (_slots.empty())
+        return;
+    // Find an empty slot, which no probe sequence crosses
+    size_t const mask = _slots.size() - 1;
+    size_t start = 0;
+    while (_slots[start].record != _empty)
+        start = (start + 1) & mask;
+    size_t const size = _size;
+    for (_Slot& slot : _slots) {
+        if (slot.record == _empty)
+            continue;
+        Bitmap& bitmap = _record(slot.record);
+        if (bitmap.buffer && bitmap.page == page) {
+            bitmap = Bitmap();
+            _free_records.push_back(slot.record);
+            slot.record = _empty;
+            --_size;
+        }
+    }
+    if (_size == size)
+        return;
+    // Compact in place : re-insert remaining slots in probe order,
+    // so that probe sequences have no holes
+    for (size_t n = 1; n < _slots.size(); ++n) {
+        size_t const i = (start + n) & mask;
+        if (_slots[i].record == _empty)
+            continue;
+        _Slot const slot = _slots[i];
+        _slots[i].record = _empty;
+        size_t j = _home(slot.key);
+        while (_slots[j].record != _empty)
+            j = (j + 1) & mask;
+        _slots[j] = slot;
+    }
+}
+
+void BitmapTable::clear() noexcept
+{
+    _slots = std::vector<_Slot>();
+    _chunks = std::vector<std::unique_ptr<Bitmap[]>>();
+    _free_records = std::vector<uint32_t>();
+    _record_count = 0;
+    _size = 0;
+}
+
+size_t BitmapTable::_home(uint64_t key) const noexcept
+{
+    // Fibonacci hashing, glyph indexes being mostly sequential
+    return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 32) & (_slots.size() - 1);
+}
+
+void BitmapTable::_rehash(size_t size)
+{
+    std::vector<_Slot> slots(size);
+    slots.swap(_slots);
+    size_t const mask = _slots.size() - 1;
+    for (_Slot const& slot : slots) {
+        if (slot.record == _empty)
+            continue;
+        size_t i = _home(slot.key);
+        while (_slots[i].record != _empty)
+            i = (i + 1) & mask;
+        _slots[i] = slot;
+    }
+}
+
+INTERNAL_END;
+SSS_TR_END;
@@ -0,0 +1,142 @@
+#ifndef SSS_TR_GLYPHATLAS_HPP
+#define SSS_TR_GLYPHATLAS_HPP
+
+#include "Lib.hpp"
+
+/** @file
+ *  Defines the internal glyph atlas, packing glyph bitmaps in pages.
+ */
+
+SSS_TR_BEGIN;
+INTERNAL_BEGIN;
+
+// A glyph bitmap, stored in a GlyphAtlas page
+struct Bitmap {
+    int pen_left{ 0 };  // Horizontal bearing
+    int pen_top{ 0 };   // Vertical bearing
+
+    int width{ 0 };     // Width, in bytes
+    int height{ 0 };    // Height, in pixels
+    int bpp{ 0 };       // Bytes per pixel
+
+    unsigned char pixel_mode{ 0 };
+
+    // Location in the atlas
+    uint32_t page{ 0 };
+    int x{ 0 };
+    int y{ 0 };
+    int pitch{ 0 };     // Row stride of the atlas page, in bytes
+    unsigned char const* buffer{ nullptr }; // Top-left pixel in the atlas page
+};
+
+// Shelf-packed atlas of glyph bitmaps. Pages are allocated once and never
+// resized, so Bitmap::buffer pointers stay valid until their page is freed.
+// Allocated pixels are accounted in Lib's glyph memory.
+class GlyphAtlas {
+public:
+    // Constructor, page_size is the width & height of regular pages
+    GlyphAtlas(int page_size);
+    // Destructor, frees all pages
+    ~GlyphAtlas() noexcept;
+
+    // Finds room for bitmap.width * bitmap.height bytes, fills the bitmap's
+    // location, and copies the given rows in it.
+    void insert(Bitmap& bitmap, unsigned char const* src, int src_pitch);
+    // Frees all pages
+    void clear() noexcept;
+    // Frees given page, whose slot is reused by later insertions
+    void freePage(uint32_t page) noexcept;
+
+    // Marks given page as used during given frame (thread-safe)
+    void touch(uint32_t page, uint64_t frame) const noexcept;
+    // Returns the last frame given page was used in
+    uint64_t getLastUse(uint32_t page) const noexcept;
+    // Returns the memory used by given page, in bytes (0 if freed)
+    size_t getPageSize(uint32_t page) const noexcept;
+    inline uint32_t getPageCount() const noexcept { return static_cast<uint32_t>(_pages.size()); };
+
+    // Returns the memory used by all pages, in bytes
+    size_t getMemorySize() const noexcept;
+    // Returns an appropriate page size for given charsize
+    static int pageSizeFor(int charsize) noexcept;
+
+private:
+    struct _Shelf {
+        int y{ 0 };         // Top of the shelf
+        int height{ 0 };    // Height of the shelf
+        int x{ 0 };         // First free column
+    };
+    struct _Page {
+        int w{ 0 };         // 0 if the page was freed
+        int h{ 0 };
+        int used_h{ 0 };    // Height used by shelves
+        std::vector<_Shelf> shelves;
+        std::vector<unsigned char> pixels;
+        mutable std::atomic<uint64_t> last_use{ 0 }; // Frame of last use
+    };
+
+    int const _page_size;
+    std::deque<_Page> _pages; // Never moved, so indexes stay valid
+
+    // Finds room for a w * h rectangle in given page. Returns false if full.
+    static bool _allocate(_Page& page, int w, int h, int& x, int& y);
+};
+
+// Open-addressing table of glyph bitmaps, keyed by glyph index & outline size
+// (0 for glyphs themselves). Records are stored in fixed-size chunks which
+// never move, so pointers to them stay valid until they are erased.
+class BitmapTable {
+public:
+    // Returns the record of given glyph, nullptr if none
+    Bitmap const* find(FT_UInt glyph_index, int outline_size) const noexcept;
+    // Stores a copy of given bitmap, unless one was already stored.
+    // Returns the stored record.
+    Bitmap const& insert(FT_UInt glyph_index, int outline_size, Bitmap const& bitmap);
+    // Erases all records stored in given atlas page, compacting the table
+    void erasePage(uint32_t page) noexcept;
+    // Erases all records
+    void clear() noexcept;
+    inline size_t size() const noexcept { return _size; };
+
+    // Calls func(glyph_index, outline_size, bitmap) for each record
+    template<typename Func>
+    void forEach(Func&& func) const {
+        for (_Slot const& slot : _slots) {
+            if (slot.record != _empty) {
+                func(static_cast<FT_UInt>(slot.key & 0xFFFFFFFF),
+                    static_cast<int>(slot.key >> 32), _record(slot.record));
+            }
+        }
+    };
+
+private:
+    struct _Slot {
+        uint64_t key{ 0 };          // Outline size << 32 | glyph index
+        uint32_t record{ _empty };  // Index of the record, _empty if none
+    };
+    static constexpr uint32_t _empty = UINT32_MAX;
+    static constexpr uint32_t _chunk_bits = 8;
+    static constexpr uint32_t _chunk_mask = (1u << _chunk_bits) - 1;
+
+    std::vector<_Slot> _slots;  // Linear probing, size is 0 or a power of 2
+    std::vector<std::unique_ptr<Bitmap[]>> _chunks; // Records, never moved
+    std::vector<uint32_t> _free_records; // Erased records, reused first
+    uint32_t _record_count{ 0 };// Records allocated in _chunks
+    size_t _size{ 0 };          // Stored records
+
+    static inline uint64_t _key(FT_UInt glyph_index, int outline_size) noexcept {
+        return static_cast<uint64_t>(static_cast<uint32_t>(outline_size)) << 32 | glyph_index;
+    };
+    inline Bitmap& _record(uint32_t record) const noexcept {
+        return _chunks[record >> _chunk_bits][record & _chunk_mask];
+    };
+    // Returns the first slot to probe for given key
+    size_t _home(uint64_t key) const noexcept;
+    // Moves all slots to a new array of given size (a power of 2)
+    void _rehash(size_t size);
+};
+
+INTERNAL_END;
+SSS_TR_END;
+
+#endif // SSS_TR_GLYPHATLAS_HPP
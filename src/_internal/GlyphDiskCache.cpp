@@ -0,0 +1,207 @@
+#include "GlyphDiskCache.hpp"
+#include <fstream>
+#include <filesystem>
+#include <cstring>
+
+SSS_TR_BEGIN;
+INTERNAL_BEGIN;
+
+std::mutex GlyphDiskCache::_mutex;
+std::string GlyphDiskCache::_directory;
+
+void GlyphDiskCache::setDirectory(std::string const& dir)
+{
+    std::lock_guard<std::mutex> const lock(_mutex);
+    _directory = dir;
+}
+
+std::string GlyphDiskCache::getDirectory()
+{
+    std::lock_guard<std::mutex> const lock(_mutex);
+    return _directory;
+}
+
+uint64_t GlyphDiskCache::hash(unsigned char const* data, size_t size, uint64_t seed) noexcept
+{
+    // FNV-1a
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+// Hashes the file size, its first 4 KiB, and the sfnt table directory of its
+// first face, whose checksums cover the content of all tables.
+// Only these pages of the mapped file are read.
+uint64_t GlyphDiskCache::hashFont(unsigned char const* data, size_t size) noexcept
+{
+    auto const read16 = [data](size_t offset) -> uint32_t {
+        return (data[offset] << 8) | data[offset + 1];
+    };
+    auto const read32 = [data](size_t offset) -> uint32_t {
+        return (uint32_t(data[offset]) << 24) | (data[offset + 1] << 16)
+            | (data[offset + 2] << 8) | data[offset + 3];
+    };
+    uint64_t result = hash(reinterpret_cast<unsigned char const*>(&size), sizeof(size));
+    // Covers the headers of non-sfnt formats
+    result = hash(data, std::min<size_t>(size, 4096), result);
+    // Collections point to the directory of each face
+    size_t directory = 0;
+    bool is_sfnt = false;
+    if (size >= 16 && read32(0) == 0x74746366) { // 'ttcf'
+        directory = read32(12);
+        is_sfnt = true;
+    }
+    else if (size >= 12) {
+        uint32_t const version = read32(0);
+        is_sfnt = version == 0x00010000 || version == 0x4F54544F  // 'OTTO'
+            || version == 0x74727565;                               // 'true'
+    }
+    if (is_sfnt && directory <= size && size - directory >= 12) {
+        size_t const length = 12 + 16 * static_cast<size_t>(read16(directory + 4));
+        result = hash(data + directory, std::min(length, size - directory), result);
+    }
+    return result;
+}
+
+GlyphDiskCache::GlyphDiskCache(uint64_t font_hash, int charsize)
+{
+    FT_UInt hdpi, vdpi;
+    Lib::getDPI(hdpi, vdpi);
+    _header.font_hash = font_hash;
+    _header.charsize = charsize;
+    _header.hdpi = hdpi;
+    _header.vdpi = vdpi;
+
+    char name[64];
+    sprintf_s(name, "%016llx-%03d-%ux%u.glyphs", static_cast<unsigned long long>(font_hash),
+        charsize, hdpi, vdpi);
+    _path = getDirectory() + "/" + name;
+
+    // Map the file if it matches the key & version
+    if (!_file.open(_path) || _file.size() < sizeof(_Header)) {
+        _file.close();
+        return;
+    }
+    _Header header;
+    std::memcpy(&header, _file.data(), sizeof(_Header));
+    if (header.magic != _magic || header.version != _version || header.font_hash != font_hash
+        || header.charsize != charsize || header.hdpi != hdpi || header.vdpi != vdpi
+        || (_file.size() - sizeof(_Header)) / sizeof(_Entry) < header.count)
+    {
+        _file.close();
+        return;
+    }
+    // Index entries, skipping truncated ones
+    unsigned char const* entries = _file.data() + sizeof(_Header);
+    for (uint32_t i = 0; i < header.count; ++i) {
+        _Entry entry;
+        std::memcpy(&entry, entries + i * sizeof(_Entry), sizeof(_Entry));
+        uint64_t const size = static_cast<uint64_t>(std::max(entry.width, 0))
+            * static_cast<uint64_t>(std::max(entry.height, 0));
+        if (entry.offset > _file.size() || size > _file.size() - entry.offset)
+            continue;
+        _entries[{ entry.glyph_index, entry.outline_size }] = entry;
+    }
+}
+
+bool GlyphDiskCache::find(FT_UInt glyph_index, int outline_size, Bitmap& bitmap,
+    unsigned char const*& pixels) const noexcept
+{
+    auto const it = _entries.find({ glyph_index, outline_size });
+    if (it == _entries.cend()) {
+        return false;
+    }
+    _Entry const& entry = it->second;
+    bitmap.pen_left = entry.pen_left;
+    bitmap.pen_top = entry.pen_top;
+    bitmap.width = entry.width;
+    bitmap.height = entry.height;
+    bitmap.bpp = entry.bpp;
+    bitmap.pixel_mode = static_cast<unsigned char>(entry.pixel_mode);
+    pixels = _file.data() + entry.offset;
+    return true;
+}
+
+bool GlyphDiskCache::isCurrentDPI() const noexcept
+{
+    FT_UInt hdpi, vdpi;
+    Lib::getDPI(hdpi, vdpi);
+    return hdpi == _header.hdpi && vdpi == _header.vdpi;
+}
+
+void GlyphDiskCache::save(BitmapTable const& bitmaps) try
+{
+    // Entries to write, along with their pixels & row stride
+    struct Source {
+        _Entry entry;
+        unsigned char const* pixels{ nullptr };
+        int pitch{ 0 };
+    };
+    std::map<std::pair<FT_UInt, int>, Source> sources;
+    bitmaps.forEach([&sources](FT_UInt glyph_index, int outline_size, Bitmap const& bitmap) {
+        Source& source = sources[{ glyph_index, outline_size }];
+        source.entry.glyph_index = glyph_index;
+        source.entry.outline_size = outline_size;
+        source.entry.pen_left = bitmap.pen_left;
+        source.entry.pen_top = bitmap.pen_top;
+        source.entry.width = bitmap.buffer ? bitmap.width : 0;
+        source.entry.height = bitmap.buffer ? bitmap.height : 0;
+        source.entry.bpp = bitmap.bpp;
+        source.entry.pixel_mode = bitmap.pixel_mode;
+        source.pixels = bitmap.buffer;
+        source.pitch = bitmap.pitch;
+    });
+    // Keep stored glyphs which were evicted, or not used during this run
+    for (auto const& [key, entry] : _entries) {
+        if (sources.count(key) == 0)
+            sources[key] = Source{ entry, _file.data() + entry.offset, entry.width };
+    }
+
+    // Compute offsets
+    _Header header = _header;
+    header.count = static_cast<uint32_t>(sources.size());
+    uint64_t offset = sizeof(_Header) + sources.size() * sizeof(_Entry);
+    for (auto& [key, source] : sources) {
+        source.entry.offset = offset;
+        offset += static_cast<uint64_t>(source.entry.width) * static_cast<uint64_t>(source.entry.height);
+    }
+
+    // Write a temporary file, then replace the previous one
+    std::filesystem::create_directories(std::filesystem::path(_path).parent_path());
+    std::string const tmp_path = _path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            throw_exc("Could not open '" + tmp_path + "' for writing.");
+        }
+        out.write(reinterpret_cast<char const*>(&header), sizeof(_Header));
+        for (auto const& [key, source] : sources) {
+            out.write(reinterpret_cast<char const*>(&source.entry), sizeof(_Entry));
+        }
+        for (auto const& [key, source] : sources) {
+            unsigned char const* row = source.pixels;
+            for (int y = 0; y < source.entry.height; ++y, row += source.pitch) {
+                out.write(reinterpret_cast<char const*>(row), source.entry.width);
+            }
+        }
+        if (!out) {
+            throw_exc("Could not write '" + tmp_path + "'.");
+        }
+    }
+    // The previous file can't be replaced while mapped
+    _entries.clear();
+    _file.close();
+    std::error_code error;
+    std::filesystem::rename(tmp_path, _path, error);
+    if (error) {
+        std::filesystem::remove(tmp_path, error);
+        throw_exc("Could not replace '" + _path + "'.");
+    }
+}
+CATCH_AND_RETHROW_METHOD_EXC;
+
+INTERNAL_END;
+SSS_TR_END;
@@ -0,0 +1,79 @@
+#ifndef SSS_TR_GLYPHDISKCACHE_HPP
+#define SSS_TR_GLYPHDISKCACHE_HPP
+
+#include "GlyphAtlas.hpp"
+#include "MappedFile.hpp"
+
+/** @file
+ *  Defines the internal persistent cache of rasterized glyphs.
+ */
+
+SSS_TR_BEGIN;
+INTERNAL_BEGIN;
+
+// Glyph & outline bitmaps of a font size, persisted across runs.
+// Each file is keyed by font file hash, charsize & DPI, and holds all outline
+// sizes. Files are memory-mapped, so hits only copy pixels to the atlas.
+class GlyphDiskCache {
+public:
+    // Sets the directory holding cache files, empty to disable the cache
+    static void setDirectory(std::string const& dir);
+    static std::string getDirectory();
+    // Returns a hash of given bytes, continuing given one
+    static uint64_t hash(unsigned char const* data, size_t size,
+        uint64_t seed = 0xcbf29ce484222325) noexcept;
+    // Returns a hash identifying given font file without reading all of it
+    static uint64_t hashFont(unsigned char const* data, size_t size) noexcept;
+
+    // Maps the file matching given key, if it exists & is valid
+    GlyphDiskCache(uint64_t font_hash, int charsize);
+
+    // Whether this file is keyed by the current DPI
+    bool isCurrentDPI() const noexcept;
+    // Fills given bitmap's metrics & pixels if stored. Returns false otherwise.
+    bool find(FT_UInt glyph_index, int outline_size, Bitmap& bitmap,
+        unsigned char const*& pixels) const noexcept;
+    // Rewrites the file with given bitmaps, keeping stored ones which aren't
+    // in them. The previous file is unmapped, so find() no longer hits.
+    void save(BitmapTable const& bitmaps);
+
+private:
+    static constexpr uint32_t _magic = 0x47535353; // "SSSG", checks endianness too
+    static constexpr uint32_t _version = 1;        // Increment on format changes
+
+    struct _Header {
+        uint32_t magic{ _magic };
+        uint32_t version{ _version };
+        uint64_t font_hash{ 0 };
+        int32_t charsize{ 0 };
+        uint32_t hdpi{ 0 };
+        uint32_t vdpi{ 0 };
+        uint32_t count{ 0 };    // Number of entries following the header
+    };
+    // Followed by the pixels of all entries, rows being tightly packed
+    struct _Entry {
+        uint64_t offset{ 0 };   // Offset of the pixels in the file
+        uint32_t glyph_index{ 0 };
+        int32_t outline_size{ 0 };
+        int32_t pen_left{ 0 };
+        int32_t pen_top{ 0 };
+        int32_t width{ 0 };
+        int32_t height{ 0 };
+        int32_t bpp{ 0 };
+        uint32_t pixel_mode{ 0 };
+    };
+
+    static std::mutex _mutex;       // Guards _directory
+    static std::string _directory;
+
+    std::string _path;
+    _Header _header;
+    MappedFile _file;
+    // Stored entries, mapped by glyph index & outline size
+    std::map<std::pair<FT_UInt, int>, _Entry> _entries;
+};
+
+INTERNAL_END;
+SSS_TR_END;
+
+#endif // SSS_TR_GLYPHDISKCACHE_HPP
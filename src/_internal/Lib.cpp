@@ -1,12 +1,19 @@
 #include "Lib.hpp"
 #include "Font.hpp"
+#include "ShapeCache.hpp"
+#include "RenderPool.hpp"
 #include "Text-Rendering/Area.hpp"
 #include "Text-Rendering\Globals.hpp"
+#include <climits>
 
 SSS_TR_BEGIN;
 INTERNAL_BEGIN;
 
 Lib::Ptr Lib::_singleton;
+std::atomic<size_t> Lib::_generation{ 1 };
+std::atomic<size_t> Lib::_glyph_memory{ 0 };
+std::atomic<size_t> Lib::_glyph_budget{ 64 << 20 }; // 64 MiB
+std::atomic<uint64_t> Lib::_frame{ 1 };
 
 Lib::Lib()
 {
@@ -106,35 +113,243 @@ Lib::FontDirs const& Lib::getFontDirs() noexcept
 Font& Lib::getFont(std::string const& font_filename) try
 {
     Lib& instance = getInstance();
-    Font::Ptr& font = instance._fonts[font_filename];
-    if (!font) {
-        font.reset(new Font(font_filename));
+    {
+        std::shared_lock<std::shared_mutex> const lock(instance._fonts_mutex);
+        auto const it = instance._fonts.find(font_filename);
+        if (it != instance._fonts.cend()) {
+            return *it->second;
+        }
+    }
+    // Load the font, unless another thread just did
+    std::unique_lock<std::shared_mutex> const lock(instance._fonts_mutex);
+    auto const it = instance._fonts.find(font_filename);
+    if (it != instance._fonts.cend()) {
+        return *it->second;
     }
-    return *font;
+    Font::Ptr font(new Font(font_filename));
+    return *instance._fonts.emplace(font_filename, std::move(font)).first->second;
 }
 CATCH_AND_RETHROW_FUNC_EXC;
 
+// State shared by the jobs of a prewarm() call
+struct Lib::_Prewarm {
+    std::string font_filename;
+    std::u32string chars;
+    int outline_size{ 0 };
+    std::once_flag loaded;              // Set by the first job, once it loaded the font
+    std::exception_ptr load_error;      // Error thrown when loading the font
+    std::promise<void> promise;
+    std::atomic<size_t> pending{ 0 };   // Jobs left
+    std::mutex mutex;                   // Guards error
+    std::exception_ptr error;           // First error thrown by a job
+
+    // Ends a job, fulfilling the promise once all jobs ended
+    void done(std::exception_ptr job_error = nullptr) {
+        std::lock_guard<std::mutex> const lock(mutex);
+        if (job_error && !error) {
+            error = job_error;
+        }
+        if (--pending == 0) {
+            if (error)
+                promise.set_exception(error);
+            else
+                promise.set_value();
+        }
+    }
+};
+
+std::shared_future<void> Lib::prewarm(std::string const& font_filename,
+    std::vector<int> const& charsizes, std::u32string const& chars, int outline_size)
+{
+    auto const state = std::make_shared<_Prewarm>();
+    state->font_filename = font_filename;
+    state->chars = chars;
+    state->outline_size = outline_size;
+    std::shared_future<void> future = state->promise.get_future().share();
+    // Split characters by batches here, jobs never queue other jobs
+    std::vector<std::pair<int, size_t>> batches;
+    for (int const charsize : charsizes) {
+        for (size_t first = 0; first < chars.size(); first += _prewarm_batch) {
+            batches.emplace_back(charsize, first);
+        }
+    }
+    if (batches.empty()) {
+        // Only load the font
+        batches.emplace_back(0, chars.size());
+    }
+    state->pending = batches.size();
+    for (size_t i = 0; i < batches.size(); ++i) {
+        int const charsize = batches[i].first;
+        size_t const first = batches[i].second;
+        try {
+            // Run after all draws
+            RenderPool::submit([state, charsize, first]() {
+                try {
+                    _prewarmBatch(*state, charsize, first);
+                    state->done();
+                }
+                catch (...) {
+                    state->done(std::current_exception());
+                }
+            }, INT_MIN, [state]() {
+                try {
+                    throw_exc("The render pool was stopped before glyphs were prewarmed.");
+                }
+                catch (...) {
+                    state->done(std::current_exception());
+                }
+            });
+        }
+        catch (...) {
+            // End the batches which weren't queued
+            for (; i < batches.size(); ++i) {
+                state->done(std::current_exception());
+            }
+            throw;
+        }
+    }
+    return future;
+}
+
+void Lib::_prewarmBatch(_Prewarm& state, int charsize, size_t first)
+{
+    // The first job loads the font, others wait for it
+    std::call_once(state.loaded, [&state]() {
+        try {
+            getFont(state.font_filename);
+        }
+        catch (...) {
+            state.load_error = std::current_exception();
+        }
+    });
+    if (state.load_error) {
+        std::rethrow_exception(state.load_error);
+    }
+    size_t const size = state.chars.size();
+    if (first >= size) {
+        return;
+    }
+    Lib& instance = getInstance();
+    // Keep the font from being unloaded while it is used
+    std::shared_lock<std::shared_mutex> const lock(instance._fonts_mutex);
+    auto const it = instance._fonts.find(state.font_filename);
+    if (it == instance._fonts.cend()) {
+        return;
+    }
+    // Shape characters so that ligatures & contextual forms are loaded too,
+    // using the whole string as context
+    size_t const length = std::min(first + _prewarm_batch + _prewarm_overlap, size) - first;
+    HB_Buffer_Ptr buffer;
+    buffer.reset(hb_buffer_create());
+    hb_buffer_add_utf32(buffer.get(), reinterpret_cast<uint32_t const*>(state.chars.c_str()),
+        static_cast<int>(size), static_cast<unsigned int>(first), static_cast<int>(length));
+    hb_buffer_guess_segment_properties(buffer.get());
+    it->second->shape(buffer.get(), charsize);
+    unsigned int glyph_count = 0;
+    hb_glyph_info_t const* info = hb_buffer_get_glyph_infos(buffer.get(), &glyph_count);
+    std::vector<FT_UInt> glyph_indexes;
+    glyph_indexes.reserve(glyph_count);
+    for (unsigned int i = 0; i < glyph_count; ++i) {
+        glyph_indexes.push_back(info[i].codepoint);
+    }
+    std::sort(glyph_indexes.begin(), glyph_indexes.end());
+    glyph_indexes.erase(std::unique(glyph_indexes.begin(), glyph_indexes.end()), glyph_indexes.end());
+    for (FT_UInt const glyph_index : glyph_indexes) {
+        it->second->loadGlyph(glyph_index, charsize, state.outline_size);
+    }
+}
+
 void Lib::unloadFont(std::string const& font_filename)
 {
     Lib& instance = getInstance();
+    // Fonts are used by draws without holding locks, stop them first
+    Area::cancelAll();
+    std::unique_lock<std::shared_mutex> const lock(instance._fonts_mutex);
     if (instance._fonts.count(font_filename) != 0) {
         instance._fonts.erase(instance._fonts.find(font_filename));
+        invalidateGlyphs();
+        ShapeCache::clear();
     }
 }
 
 void Lib::clearFonts() noexcept
 {
     Lib& instance = getInstance();
+    // Fonts are used by draws without holding locks, stop them first
+    Area::cancelAll();
+    std::unique_lock<std::shared_mutex> const lock(instance._fonts_mutex);
     instance._fonts.clear();
+    invalidateGlyphs();
+    ShapeCache::clear();
 }
 
 
+void Lib::invalidateGlyphs() noexcept
+{
+    ++_generation;
+}
+
+void Lib::touchGlyphPages(std::string const& font_filename, int charsize,
+    std::vector<uint32_t> const& pages) noexcept
+{
+    Lib& instance = getInstance();
+    std::shared_lock<std::shared_mutex> const lock(instance._fonts_mutex);
+    auto const it = instance._fonts.find(font_filename);
+    if (it != instance._fonts.cend()) {
+        it->second->touchPages(charsize, pages);
+    }
+}
+
+bool Lib::canTrimGlyphs(std::unordered_set<Bitmap const*> const& pinned)
+{
+    Lib& instance = getInstance();
+    std::shared_lock<std::shared_mutex> const lock(instance._fonts_mutex);
+    std::vector<FontSize::Page> pages;
+    for (auto const& [font_filename, font] : instance._fonts) {
+        font->listUnpinnedPages(pinned, pages);
+        if (!pages.empty())
+            return true;
+    }
+    return false;
+}
+
+void Lib::trimGlyphs(std::unordered_set<Bitmap const*> const& pinned)
+{
+    if (!isOverGlyphBudget()) {
+        return;
+    }
+    Lib& instance = getInstance();
+    std::shared_lock<std::shared_mutex> const lock(instance._fonts_mutex);
+    std::vector<FontSize::Page> pages;
+    for (auto const& [font_filename, font] : instance._fonts) {
+        font->listUnpinnedPages(pinned, pages);
+    }
+    // Least recently used first
+    std::sort(pages.begin(), pages.end(), [](FontSize::Page const& a, FontSize::Page const& b) {
+        return a.last_use < b.last_use;
+    });
+    size_t const target = _glyph_budget - _glyph_budget / 4;
+    for (FontSize::Page const& page : pages) {
+        if (_glyph_memory <= target)
+            break;
+        page.font_size->evictPage(page.index);
+    }
+}
+
 void Lib::setDPI(FT_UInt hdpi, FT_UInt vdpi)
 {
     // TODO: reload all cache if DPIs changed
     Lib& instance = getInstance();
+    // Persistent glyph caches are keyed by DPI, save them under the previous one
+    if (hdpi != instance._hdpi || vdpi != instance._vdpi) {
+        std::shared_lock<std::shared_mutex> const lock(instance._fonts_mutex);
+        for (auto const& [font_filename, font] : instance._fonts) {
+            font->closeDiskCaches();
+        }
+    }
     instance._hdpi = hdpi;
     instance._vdpi = vdpi;
+    ShapeCache::clear();
 }
 
 void Lib::getDPI(FT_UInt& hdpi, FT_UInt& vdpi) noexcept
@@ -153,6 +368,9 @@ SSS_TR_API void init()
 
 SSS_TR_API void terminate()
 {
+    // Ensure no draw uses fonts past this point
+    Area::cancelAll();
+    _internal::RenderPool::stop();
     _internal::Lib::terminate();
 }
 
@@ -168,6 +386,17 @@ void loadFont(std::string const& font_filename) try
 }
 CATCH_AND_RETHROW_FUNC_EXC;
 
+std::shared_future<void> loadFontAsync(std::string const& font_filename)
+{
+    return _internal::Lib::prewarm(font_filename, {}, std::u32string(), 0);
+}
+
+std::shared_future<void> prewarmGlyphs(std::string const& font_filename,
+    std::vector<int> const& charsizes, std::u32string const& chars, int outline_size)
+{
+    return _internal::Lib::prewarm(font_filename, charsizes, chars, outline_size);
+}
+
 void unloadFont(std::string const& font_filename)
 {
     _internal::Lib::unloadFont(font_filename);
@@ -178,6 +407,31 @@ void clearFonts() noexcept
     _internal::Lib::clearFonts();
 }
 
+void setGlyphCacheSize(size_t bytes) noexcept
+{
+    _internal::Lib::setGlyphBudget(bytes);
+}
+
+size_t getGlyphCacheSize() noexcept
+{
+    return _internal::Lib::getGlyphBudget();
+}
+
+size_t getGlyphCacheUsage() noexcept
+{
+    return _internal::Lib::getGlyphMemory();
+}
+
+void setGlyphDiskCacheDir(std::string const& dir_path)
+{
+    _internal::GlyphDiskCache::setDirectory(dir_path);
+}
+
+std::string getGlyphDiskCacheDir()
+{
+    return _internal::GlyphDiskCache::getDirectory();
+}
+
 void setDPI(FT_UInt hdpi, FT_UInt vdpi)
 {
     _internal::Lib::setDPI(hdpi, vdpi);
@@ -2,6 +2,10 @@
 #define SSS_TR_LIB_HPP
 
 #include "Text-Rendering/_includes.hpp"
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <future>
 
 namespace SSS::Log::TR {
     /** Logging properties for SSS::TR globals.*/
@@ -30,8 +34,9 @@ using HB_Font_Ptr = C_Ptr
 using HB_Buffer_Ptr = C_Ptr
     <hb_buffer_t, void(*)(hb_buffer_t*), hb_buffer_destroy>;
 
-// Pre-declaration
+// Pre-declarations
 class Font;
+struct Bitmap;
 
 class Lib {
 private:
@@ -44,11 +49,29 @@ private:
     FontDirs _font_dirs;    // Font directories
     using FontMap = std::map<std::string, std::unique_ptr<Font>>;
     FontMap _fonts;         // Fonts
+    std::shared_mutex _fonts_mutex; // Guards _fonts : many readers, one writer
+    // Incremented whenever loaded glyphs are freed
+    static std::atomic<size_t> _generation;
+    // Pixel memory of all glyph atlases, and its budget (0 -> unlimited)
+    static std::atomic<size_t> _glyph_memory;
+    static std::atomic<size_t> _glyph_budget;
+    // Incremented by each Area::updateAll(), atlas pages store the last one they were used in
+    static std::atomic<uint64_t> _frame;
 
     using Ptr = std::unique_ptr<Lib>;
     static Ptr _singleton;
     static Lib& getInstance();
 
+    // State shared by the jobs of a prewarm() call
+    struct _Prewarm;
+    // Loads the font once, then shapes given characters & loads their glyphs,
+    // unless the font was unloaded meanwhile
+    static void _prewarmBatch(_Prewarm& state, int charsize, size_t first);
+    // Number of characters per prewarm job, so that draws can run in between
+    static constexpr size_t _prewarm_batch = 16;
+    // Characters shaped past each batch, so that ligatures across batches are loaded
+    static constexpr size_t _prewarm_overlap = 8;
+
     Lib();
 public:
     ~Lib();
@@ -60,9 +83,38 @@ public:
     static FontDirs const& getFontDirs() noexcept;
 
     static Font& getFont(std::string const& font_filename);
+    // Loads given font on the render pool, then shapes & rasterizes given
+    // characters at given charsizes, by small jobs all queued from here.
+    // Unloading the font meanwhile skips the remaining glyphs.
+    static std::shared_future<void> prewarm(std::string const& font_filename,
+        std::vector<int> const& charsizes, std::u32string const& chars, int outline_size);
     static void unloadFont(std::string const&);
     static void clearFonts() noexcept;
 
+    // Bitmap pointers resolved under an older generation are dangling
+    static inline size_t getGeneration() noexcept { return _generation; };
+    static void invalidateGlyphs() noexcept;
+
+    static inline void addGlyphMemory(size_t bytes) noexcept { _glyph_memory += bytes; };
+    static inline void removeGlyphMemory(size_t bytes) noexcept { _glyph_memory -= bytes; };
+    static inline size_t getGlyphMemory() noexcept { return _glyph_memory; };
+    static inline void setGlyphBudget(size_t bytes) noexcept { _glyph_budget = bytes; };
+    static inline size_t getGlyphBudget() noexcept { return _glyph_budget; };
+    static inline bool isOverGlyphBudget() noexcept {
+        return _glyph_budget != 0 && _glyph_memory > _glyph_budget;
+    };
+    static inline uint64_t getFrame() noexcept { return _frame.load(std::memory_order_relaxed); };
+    static inline void nextFrame() noexcept { ++_frame; };
+    // Marks given atlas pages of given font & charsize as used, if still loaded
+    static void touchGlyphPages(std::string const& font_filename, int charsize,
+        std::vector<uint32_t> const& pages) noexcept;
+    // Whether any atlas page holds none of the given bitmaps, i.e. could be freed
+    static bool canTrimGlyphs(std::unordered_set<Bitmap const*> const& pinned);
+    // Frees least recently used atlas pages holding none of the given bitmaps,
+    // until glyph memory goes below 3/4 of its budget.
+    // Draws must be stopped, as they may use any bitmap.
+    static void trimGlyphs(std::unordered_set<Bitmap const*> const& pinned);
+
     static void setDPI(FT_UInt, FT_UInt);
     static void getDPI(FT_UInt&, FT_UInt&) noexcept;
 };
@@ -0,0 +1,133 @@
+#include "MappedFile.hpp"
+#include <filesystem>
+#if defined(_WIN32)
+# ifndef WIN32_LEAN_AND_MEAN
+#  define WIN32_LEAN_AND_MEAN
+# endif
+# ifndef NOMINMAX
+#  define NOMINMAX
+# endif
+# include <Windows.h>
+#else
+# include <sys/mman.h>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+SSS_TR_BEGIN;
+INTERNAL_BEGIN;
+
+std::mutex MappedFile::_shared_mutex;
+std::map<std::string, std::weak_ptr<MappedFile const>> MappedFile::_shared;
+
+#if defined(_WIN32)
+
+bool MappedFile::open(std::string const& path)
+{
+    close();
+    HANDLE const file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+        nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    _file = file;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        close();
+        return false;
+    }
+    _mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!_mapping) {
+        close();
+        return false;
+    }
+    _data = static_cast<unsigned char const*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!_data) {
+        close();
+        return false;
+    }
+    _size = static_cast<size_t>(size.QuadPart);
+    return true;
+}
+
+void MappedFile::close() noexcept
+{
+    if (_data)
+        UnmapViewOfFile(_data);
+    if (_mapping)
+        CloseHandle(_mapping);
+    if (_file)
+        CloseHandle(_file);
+    _data = nullptr;
+    _size = 0;
+    _mapping = nullptr;
+    _file = nullptr;
+}
+
+#else
+
+bool MappedFile::open(std::string const& path)
+{
+    close();
+    int const fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* const data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        if (data != MAP_FAILED) {
+            _data = static_cast<unsigned char const*>(data);
+            _size = static_cast<size_t>(st.st_size);
+        }
+    }
+    // The mapping keeps its own reference to the file
+    ::close(fd);
+    return isOpen();
+}
+
+void MappedFile::close() noexcept
+{
+    if (_data)
+        munmap(const_cast<unsigned char*>(_data), _size);
+    _data = nullptr;
+    _size = 0;
+}
+
+#endif
+
+MappedFile::MappedFile(std::string const& path)
+{
+    open(path);
+}
+
+MappedFile::~MappedFile() noexcept
+{
+    close();
+}
+
+std::shared_ptr<MappedFile const> MappedFile::share(std::string const& path)
+{
+    std::error_code error;
+    std::string key = std::filesystem::canonical(path, error).string();
+    if (error) {
+        key = path;
+    }
+    std::lock_guard<std::mutex> const lock(_shared_mutex);
+    // Forget unreferenced mappings
+    std::erase_if(_shared, [](auto const& it) { return it.second.expired(); });
+    std::shared_ptr<MappedFile const> file = _shared[key].lock();
+    if (!file) {
+        std::shared_ptr<MappedFile> const mapped = std::make_shared<MappedFile>(path);
+        if (!mapped->isOpen()) {
+            _shared.erase(key);
+            return nullptr;
+        }
+        file = mapped;
+        _shared[key] = file;
+    }
+    return file;
+}
+
+INTERNAL_END;
+SSS_TR_END;
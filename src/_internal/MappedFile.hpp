@@ -0,0 +1,54 @@
+#ifndef SSS_TR_MAPPEDFILE_HPP
+#define SSS_TR_MAPPEDFILE_HPP
+
+#include "Text-Rendering/_includes.hpp"
+#include <mutex>
+
+/** @file
+ *  Defines the internal read-only file mapping.
+ */
+
+SSS_TR_BEGIN;
+INTERNAL_BEGIN;
+
+// Read-only memory mapping of a whole file. Pages are loaded by the OS
+// on first access, and shared between processes mapping the same file.
+class MappedFile {
+public:
+    MappedFile() = default;
+    // Maps given file. Check isOpen() on failure.
+    MappedFile(std::string const& path);
+    // Unmaps the file
+    ~MappedFile() noexcept;
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+
+    inline bool isOpen() const noexcept { return _data != nullptr; };
+    inline unsigned char const* data() const noexcept { return _data; };
+    inline size_t size() const noexcept { return _size; };
+    // Maps given file, unmapping the previous one. Returns false on failure.
+    bool open(std::string const& path);
+    // Unmaps the file, if any
+    void close() noexcept;
+
+    // Returns the shared mapping of given file, mapping it if needed, or
+    // nullptr on failure. Paths are canonicalized, so that all aliases of a
+    // file share a single mapping, which lives as long as it is referenced.
+    static std::shared_ptr<MappedFile const> share(std::string const& path);
+
+private:
+    unsigned char const* _data{ nullptr };
+    size_t _size{ 0 };
+    // Shared mappings, by canonical path
+    static std::mutex _shared_mutex;
+    static std::map<std::string, std::weak_ptr<MappedFile const>> _shared;
+#if defined(_WIN32)
+    void* _file{ nullptr };     // File HANDLE
+    void* _mapping{ nullptr };  // File mapping HANDLE
+#endif
+};
+
+INTERNAL_END;
+SSS_TR_END;
+
+#endif // SSS_TR_MAPPEDFILE_HPP
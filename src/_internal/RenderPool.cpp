@@ -0,0 +1,216 @@
+#include "RenderPool.hpp"
+
+SSS_TR_BEGIN;
+INTERNAL_BEGIN;
+
+std::mutex RenderPool::_join_mutex;
+std::mutex RenderPool::_mutex;
+std::vector<std::unique_ptr<RenderPool::_Queue>> RenderPool::_queues;
+std::vector<std::thread> RenderPool::_threads;
+std::shared_ptr<RenderExecutor> RenderPool::_executor;
+unsigned int RenderPool::_thread_count{ 0 };
+std::mutex RenderPool::_wait_mutex;
+std::condition_variable RenderPool::_wait;
+std::atomic<size_t> RenderPool::_pending{ 0 };
+std::atomic<uint64_t> RenderPool::_order{ 0 };
+std::atomic<bool> RenderPool::_stop{ false };
+
+// Joins workers before the static members above are destroyed
+static struct RenderPoolGuard {
+    ~RenderPoolGuard() { RenderPool::stop(); };
+} render_pool_guard;
+
+void RenderPool::submit(Job job, int priority, Job cancel)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_executor) {
+        std::shared_ptr<RenderExecutor> const executor = _executor;
+        lock.unlock();
+        executor->submit(std::move(job), priority);
+        return;
+    }
+    _start();
+    _push(_Task{ std::move(job), std::move(cancel), priority, _order++ });
+}
+
+void RenderPool::setThreadCount(unsigned int count)
+{
+    std::lock_guard<std::mutex> const join_lock(_join_mutex);
+    std::unique_lock<std::mutex> lock(_mutex);
+    std::vector<_Task> tasks = _join(lock);
+    _thread_count = count;
+    if (!tasks.empty()) {
+        _start();
+        for (_Task& task : tasks) {
+            _push(std::move(task));
+        }
+    }
+}
+
+unsigned int RenderPool::getThreadCount() noexcept
+{
+    std::lock_guard<std::mutex> const lock(_mutex);
+    if (_thread_count != 0)
+        return _thread_count;
+    unsigned int const hardware = std::thread::hardware_concurrency();
+    return hardware > 1 ? hardware - 1 : 1;
+}
+
+void RenderPool::setExecutor(std::shared_ptr<RenderExecutor> executor)
+{
+    std::lock_guard<std::mutex> const join_lock(_join_mutex);
+    std::unique_lock<std::mutex> lock(_mutex);
+    _executor = executor;
+    // Hand queued tasks over to the executor
+    if (_executor) {
+        for (_Task& task : _join(lock)) {
+            _executor->submit(std::move(task.job), task.priority);
+        }
+    }
+}
+
+void RenderPool::stop() noexcept
+{
+    std::lock_guard<std::mutex> const join_lock(_join_mutex);
+    std::unique_lock<std::mutex> lock(_mutex);
+    std::vector<_Task> tasks = _join(lock);
+    _executor.reset();
+    lock.unlock();
+    // Let whatever waits for dropped jobs know they won't run
+    for (_Task& task : tasks) {
+        if (task.cancel)
+            task.cancel();
+    }
+}
+
+void RenderPool::_start()
+{
+    // Queues outlive workers while they are joined
+    if (!_queues.empty()) {
+        return;
+    }
+    unsigned int count = _thread_count;
+    if (count == 0) {
+        unsigned int const hardware = std::thread::hardware_concurrency();
+        count = hardware > 1 ? hardware - 1 : 1;
+    }
+    for (unsigned int i = 0; i < count; ++i) {
+        _queues.emplace_back(std::make_unique<_Queue>());
+    }
+    for (size_t i = 0; i < count; ++i) {
+        _threads.emplace_back(_work, i);
+    }
+}
+
+std::vector<RenderPool::_Task> RenderPool::_join(std::unique_lock<std::mutex>& lock) noexcept
+{
+    {
+        std::lock_guard<std::mutex> const wait_lock(_wait_mutex);
+        _stop = true;
+    }
+    _wait.notify_all();
+    std::vector<std::thread> threads;
+    threads.swap(_threads);
+    if (!threads.empty()) {
+        // Running jobs may submit meanwhile, to the queues which are kept
+        lock.unlock();
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        lock.lock();
+    }
+    std::vector<_Task> tasks;
+    for (auto const& queue : _queues) {
+        std::move(queue->tasks.begin(), queue->tasks.end(), std::back_inserter(tasks));
+    }
+    _queues.clear();
+    _pending = 0;
+    _stop = false;
+    return tasks;
+}
+
+void RenderPool::_push(_Task task)
+{
+    // Spread tasks across queues, idle workers steal the surplus
+    _Queue& queue = *_queues.at(task.order % _queues.size());
+    {
+        std::lock_guard<std::mutex> const lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+        std::push_heap(queue.tasks.begin(), queue.tasks.end());
+    }
+    {
+        std::lock_guard<std::mutex> const lock(_wait_mutex);
+        ++_pending;
+    }
+    _wait.notify_one();
+}
+
+bool RenderPool::_pop(size_t index, _Task& task)
+{
+    size_t const count = _queues.size();
+    for (;;) {
+        // Find the top task of all queues, job left empty
+        _Task best;
+        size_t best_index = count;
+        for (size_t i = 0; i < count; ++i) {
+            size_t const queue_index = (index + i) % count;
+            _Queue& queue = *_queues[queue_index];
+            std::lock_guard<std::mutex> const lock(queue.mutex);
+            if (queue.tasks.empty())
+                continue;
+            _Task const& top = queue.tasks.front();
+            if (best_index == count || best < top) {
+                best.priority = top.priority;
+                best.order = top.order;
+                best_index = queue_index;
+            }
+        }
+        if (best_index == count) {
+            return false;
+        }
+        // Pop it, unless another worker did meanwhile (orders are unique)
+        _Queue& queue = *_queues[best_index];
+        std::lock_guard<std::mutex> const lock(queue.mutex);
+        if (queue.tasks.empty() || queue.tasks.front().order != best.order)
+            continue;
+        std::pop_heap(queue.tasks.begin(), queue.tasks.end());
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        --_pending;
+        return true;
+    }
+}
+
+void RenderPool::_work(size_t index)
+{
+    _Task task;
+    while (!_stop) {
+        if (_pop(index, task)) {
+            // Jobs handle their own errors
+            task.job();
+            task.job = nullptr;
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(_wait_mutex);
+        _wait.wait(lock, [] { return _stop || _pending != 0; });
+    }
+}
+
+INTERNAL_END;
+
+void setRenderThreadCount(unsigned int count)
+{
+    _internal::RenderPool::setThreadCount(count);
+}
+
+unsigned int getRenderThreadCount() noexcept
+{
+    return _internal::RenderPool::getThreadCount();
+}
+
+void setRenderExecutor(std::shared_ptr<RenderExecutor> executor)
+{
+    _internal::RenderPool::setExecutor(executor);
+}
+
+SSS_TR_END;
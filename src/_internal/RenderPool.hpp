@@ -0,0 +1,78 @@
+#ifndef SSS_TR_RENDERPOOL_HPP
+#define SSS_TR_RENDERPOOL_HPP
+
+#include "Text-Rendering/Globals.hpp"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+/** @file
+ *  Defines the internal pool of draw workers shared by all areas.
+ */
+
+SSS_TR_BEGIN;
+INTERNAL_BEGIN;
+
+// Process-wide, fixed-size pool of draw workers. Tasks are spread across
+// queues ordered by priority, one per worker, and workers run the highest
+// priority task of all queues, stealing it when it isn't in their own.
+// Jobs are handed to the host's RenderExecutor instead, if any.
+class RenderPool {
+public:
+    using Job = std::function<void()>;
+
+    // Queues given job, higher priorities being run first. Given cancel
+    // function, which must not throw, is run instead if stop() drops the job.
+    static void submit(Job job, int priority, Job cancel = nullptr);
+    // Restarts workers with given count (0 -> hardware concurrency - 1)
+    static void setThreadCount(unsigned int count);
+    static unsigned int getThreadCount() noexcept;
+    static void setExecutor(std::shared_ptr<RenderExecutor> executor);
+    // Joins all workers, canceling queued jobs
+    static void stop() noexcept;
+
+private:
+    struct _Task {
+        Job job;
+        Job cancel;          // Run instead of job when dropped
+        int priority{ 0 };
+        uint64_t order{ 0 }; // Submission order, FIFO among equal priorities
+        bool operator<(_Task const& task) const noexcept {
+            return priority != task.priority ? priority < task.priority : order > task.order;
+        };
+    };
+    // Binary heap of tasks, top being the next to run
+    struct _Queue {
+        std::mutex mutex;
+        std::vector<_Task> tasks;
+    };
+
+    static std::mutex _join_mutex;          // Serializes joins, locked before _mutex
+    static std::mutex _mutex;               // Guards workers & executor
+    static std::vector<std::unique_ptr<_Queue>> _queues; // One per worker
+    static std::vector<std::thread> _threads;
+    static std::shared_ptr<RenderExecutor> _executor;
+    static unsigned int _thread_count;      // 0 -> hardware concurrency - 1
+    static std::mutex _wait_mutex;          // Used to put idle workers to sleep
+    static std::condition_variable _wait;
+    static std::atomic<size_t> _pending;    // Number of queued tasks
+    static std::atomic<uint64_t> _order;
+    static std::atomic<bool> _stop;         // Set to join workers
+
+    // Starts workers if needed, _mutex must be locked
+    static void _start();
+    // Joins workers and returns their queued tasks, _join_mutex & _mutex must
+    // be locked. _mutex is released while joining, so that jobs can submit.
+    static std::vector<_Task> _join(std::unique_lock<std::mutex>& lock) noexcept;
+    static void _push(_Task task);
+    // Pops the highest priority task of all queues, starting with given worker's
+    static bool _pop(size_t index, _Task& task);
+    static void _work(size_t index);
+};
+
+INTERNAL_END;
+SSS_TR_END;
+
+#endif // SSS_TR_RENDERPOOL_HPP
@@ -0,0 +1,136 @@
+#include "ShapeCache.hpp"
+#include "Text-Rendering/Globals.hpp"
+
+SSS_TR_BEGIN;
+INTERNAL_BEGIN;
+
+std::mutex ShapeCache::_mutex;
+std::unordered_map<ShapeCache::Key, ShapeCache::_Entry, ShapeCache::_KeyHash> ShapeCache::_entries;
+std::list<ShapeCache::Key const*> ShapeCache::_lru;
+size_t ShapeCache::_size{ 0 };
+size_t ShapeCache::_max_size{ 4 << 20 }; // 4 MiB
+size_t ShapeCache::_hits{ 0 };
+size_t ShapeCache::_misses{ 0 };
+
+size_t ShapeCache::_KeyHash::operator()(Key const& key) const noexcept
+{
+    size_t hash = std::hash<std::u32string>{}(key.str);
+    auto const combine = [&hash](size_t value) {
+        hash ^= value + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    };
+    combine(std::hash<std::string>{}(key.font));
+    combine(std::hash<int>{}(key.charsize));
+    combine(std::hash<int>{}(static_cast<int>(key.direction)));
+    combine(std::hash<int>{}(static_cast<int>(key.script)));
+    combine(std::hash<void const*>{}(key.language));
+    return hash;
+}
+
+bool ShapeCache::get(Key const& key, std::vector<GlyphInfo>& glyphs)
+{
+    std::lock_guard<std::mutex> const lock(_mutex);
+    if (_max_size == 0)
+        return false;
+    auto const it = _entries.find(key);
+    if (it == _entries.end()) {
+        ++_misses;
+        return false;
+    }
+    ++_hits;
+    // Mark as most recently used
+    _lru.splice(_lru.begin(), _lru, it->second.lru);
+    glyphs = it->second.glyphs;
+    return true;
+}
+
+void ShapeCache::add(Key const& key, std::vector<GlyphInfo> const& glyphs)
+{
+    std::lock_guard<std::mutex> const lock(_mutex);
+    if (_max_size == 0 || _entries.count(key) != 0)
+        return;
+    size_t const size = sizeof(Key) + sizeof(_Entry) + key.font.size()
+        + key.str.size() * sizeof(char32_t) + glyphs.size() * sizeof(GlyphInfo);
+    if (size > _max_size)
+        return;
+    auto const [it, inserted] = _entries.emplace(key, _Entry());
+    _Entry& entry = it->second;
+    entry.glyphs = glyphs;
+    entry.size = size;
+    _lru.push_front(&it->first);
+    entry.lru = _lru.begin();
+    _size += size;
+    _evict();
+}
+
+void ShapeCache::clear() noexcept
+{
+    std::lock_guard<std::mutex> const lock(_mutex);
+    _entries.clear();
+    _lru.clear();
+    _size = 0;
+}
+
+void ShapeCache::setMaxSize(size_t bytes)
+{
+    std::lock_guard<std::mutex> const lock(_mutex);
+    _max_size = bytes;
+    _evict();
+}
+
+size_t ShapeCache::getMaxSize() noexcept
+{
+    std::lock_guard<std::mutex> const lock(_mutex);
+    return _max_size;
+}
+
+size_t ShapeCache::getSize() noexcept
+{
+    std::lock_guard<std::mutex> const lock(_mutex);
+    return _size;
+}
+
+void ShapeCache::getStats(size_t& hits, size_t& misses) noexcept
+{
+    std::lock_guard<std::mutex> const lock(_mutex);
+    hits = _hits;
+    misses = _misses;
+}
+
+void ShapeCache::_evict() noexcept
+{
+    while (_size > _max_size && !_lru.empty()) {
+        auto const it = _entries.find(*_lru.back());
+        _size -= it->second.size;
+        _lru.pop_back();
+        _entries.erase(it);
+    }
+}
+
+INTERNAL_END;
+
+void setShapingCacheSize(size_t bytes)
+{
+    _internal::ShapeCache::setMaxSize(bytes);
+}
+
+size_t getShapingCacheSize() noexcept
+{
+    return _internal::ShapeCache::getMaxSize();
+}
+
+size_t getShapingCacheUsage() noexcept
+{
+    return _internal::ShapeCache::getSize();
+}
+
+void getShapingCacheStats(size_t& hits, size_t& misses) noexcept
+{
+    _internal::ShapeCache::getStats(hits, misses);
+}
+
+void clearShapingCache() noexcept
+{
+    _internal::ShapeCache::clear();
+}
+
+SSS_TR_END;
@@ -0,0 +1,71 @@
+#ifndef SSS_TR_SHAPECACHE_HPP
+#define SSS_TR_SHAPECACHE_HPP
+
+#include "Buffer.hpp"
+#include <list>
+#include <unordered_map>
+#include <mutex>
+
+/** @file
+ *  Defines the internal process-wide cache of shaped runs.
+ */
+
+SSS_TR_BEGIN;
+INTERNAL_BEGIN;
+
+// Process-wide, size-bounded (LRU) cache of shaped glyph runs, shared by
+// all buffers so that identical strings aren't shaped again.
+class ShapeCache {
+public:
+    // Everything the result of hb_shape() depends on
+    struct Key {
+        std::string font;
+        int charsize{ 0 };
+        hb_direction_t direction{ HB_DIRECTION_INVALID };
+        hb_script_t script{ HB_SCRIPT_INVALID };
+        hb_language_t language{ nullptr };
+        std::u32string str;
+        bool operator==(Key const&) const = default;
+    };
+
+    // Runs longer than this aren't cached (mostly edited text)
+    static constexpr size_t max_length = 256;
+
+    // Copies cached glyphs into given vector. Returns false on miss.
+    static bool get(Key const& key, std::vector<GlyphInfo>& glyphs);
+    // Stores given glyphs, evicting least recently used entries if needed
+    static void add(Key const& key, std::vector<GlyphInfo> const& glyphs);
+    // Clears all entries (hit & miss counts are kept)
+    static void clear() noexcept;
+
+    static void setMaxSize(size_t bytes);
+    static size_t getMaxSize() noexcept;
+    static size_t getSize() noexcept;
+    static void getStats(size_t& hits, size_t& misses) noexcept;
+
+private:
+    struct _KeyHash {
+        size_t operator()(Key const& key) const noexcept;
+    };
+    struct _Entry {
+        std::vector<GlyphInfo> glyphs;
+        std::list<Key const*>::iterator lru; // Position in _lru
+        size_t size{ 0 };                    // Estimated memory size
+    };
+
+    static std::mutex _mutex;
+    static std::unordered_map<Key, _Entry, _KeyHash> _entries;
+    static std::list<Key const*> _lru; // Most recently used first
+    static size_t _size;               // Estimated memory size of all entries
+    static size_t _max_size;           // Memory budget
+    static size_t _hits;
+    static size_t _misses;
+
+    // Evicts least recently used entries until the budget is respected
+    static void _evict() noexcept;
+};
+
+INTERNAL_END;
+SSS_TR_END;
+
+#endif // SSS_TR_SHAPECACHE_HPP